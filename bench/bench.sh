@@ -0,0 +1,183 @@
+#!/bin/sh
+# Measures the efficiency of the protocol over an emulated serial link, while
+# sweeping one parameter at a time, like the tables of the report.
+#
+# Every sweep writes a table to $BENCH_OUT/<sweep>.tsv, with the time of each
+# run, their mean, the resulting bitrate R and efficiency S = R / C, and the
+# half width of their 95% confidence intervals. Failed runs are NA.
+#
+# Usage: bench.sh [sweep...], where a sweep is one of c, fer, tprop or size.
+
+set -eu
+
+BIN=${BIN:-bin}
+MAIN=${BENCH_MAIN:-$BIN/bench}
+LINK=${BENCH_LINK:-$BIN/link}
+RUNS=${BENCH_RUNS:-2}
+FILE=${BENCH_FILE:-neuron.jpg}
+OUT=${BENCH_OUT:-bench/results}
+TIMEOUT=${BENCH_TIMEOUT:-300}
+
+# The parameters that aren't being swept
+DEFAULT_C=${BENCH_C:-57600}
+DEFAULT_FER=${BENCH_FER:-0}
+DEFAULT_T_PROP=${BENCH_T_PROP:-0}
+DEFAULT_PS=${BENCH_PS:-1024}
+
+MAIN=$(realpath "$MAIN")
+LINK=$(realpath "$LINK")
+FILE=$(realpath "$FILE")
+NAME=$(basename "$FILE")
+FS=$(($(wc -c < "$FILE") * 8))
+
+mkdir -p "$OUT"
+
+# Transfers the file once, printing how long it took in seconds, or NA.
+# Arguments: C FER T_PROP PACKET_SIZE
+run_once() {
+    dir=$(mktemp -d)
+    cp "$FILE" "$dir/"
+
+    "$LINK" "$dir/tx" "$dir/rx" "$1" &
+    link=$!
+
+    while [ ! -e "$dir/rx" ] || [ ! -e "$dir/tx" ]; do
+        sleep 0.1
+    done
+
+    export C="$1" FER="$2" T_PROP="$3" PACKET_SIZE="$4"
+
+    (cd "$dir" && timeout "$TIMEOUT" "$MAIN" "$dir/rx" rx x > rx.log 2>&1) &
+    rx=$!
+    sleep 0.2
+    (cd "$dir" && timeout "$TIMEOUT" "$MAIN" "$dir/tx" tx "$NAME" \
+        > tx.log 2>&1) || true
+    wait $rx || true
+
+    unset C FER T_PROP PACKET_SIZE
+
+    kill $link
+    wait $link || true
+
+    received=$(find "$dir" -name '*_received*' | head -n 1)
+
+    if [ -n "$received" ] && cmp -s "$FILE" "$received"; then
+        sed -n 's/.*Took \([0-9]*\)ns.*/\1/p' "$dir/tx.log" |
+            awk '{ printf "%.9g\n", $1 / 1e9 }'
+    else
+        echo NA
+    fi
+
+    rm -rf "$dir"
+}
+
+# Prints a row of a table, from the value swept and the times of each run.
+# Arguments: X C t1 t2 ...
+summarize() {
+    echo "$@" | awk -v fs="$FS" '
+    BEGIN {
+        # Two-sided 95% quantiles of the t distribution, by degrees of freedom
+        split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+              "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086 " \
+              "2.080 2.074 2.069 2.064 2.060 2.056 2.052 2.048 2.045 2.042",
+              quantiles, " ")
+    }
+    {
+        row = $1
+        c = $2
+        n = 0
+        sum = 0
+
+        for (i = 3; i <= NF; ++i) {
+            row = row "\t" $i
+            if ($i != "NA") {
+                times[++n] = $i
+                sum += $i
+            }
+        }
+
+        if (n == 0) {
+            print row "\tNA\tNA\tNA\tNA\tNA\tNA"
+            exit
+        }
+
+        t = sum / n
+        r = fs / t
+        s = r / c
+
+        if (n == 1) {
+            printf "%s\t%.10g\t%.10g\t%.10g\tNA\tNA\tNA\n", row, t, r, s
+            exit
+        }
+
+        var = 0
+        for (i = 1; i <= n; ++i)
+            var += (times[i] - t) ^ 2
+        var /= n - 1
+
+        q = n - 1 <= 30 ? quantiles[n - 1] : 1.960
+        t_ci = q * sqrt(var / n)
+
+        # R = FS / t, so its error is approximately R * t_ci / t
+        r_ci = r * t_ci / t
+
+        printf "%s\t%.10g\t%.10g\t%.10g\t%.10g\t%.10g\t%.10g\n",
+               row, t, r, s, t_ci, r_ci, r_ci / c
+    }'
+}
+
+# Runs a sweep over the values of one parameter.
+# Arguments: sweep column values...
+sweep() {
+    name=$1
+    column=$2
+    shift 2
+
+    table="$OUT/$name.tsv"
+    header="$column"
+    i=1
+    while [ $i -le "$RUNS" ]; do
+        header="$header\tt$i"
+        i=$((i + 1))
+    done
+    printf "%b\tt\tR\tS\tt_ci\tR_ci\tS_ci\n" "$header" > "$table"
+
+    for value in "$@"; do
+        c=$DEFAULT_C fer=$DEFAULT_FER t_prop=$DEFAULT_T_PROP ps=$DEFAULT_PS
+
+        case $name in
+        c) c=$value ;;
+        fer) fer=$value ;;
+        tprop) t_prop=$value ;;
+        size) ps=$value ;;
+        esac
+
+        times=""
+        i=1
+        while [ $i -le "$RUNS" ]; do
+            echo "$name=$value, run $i of $RUNS" >&2
+            times="$times $(run_once "$c" "$fer" "$t_prop" "$ps")"
+            i=$((i + 1))
+        done
+
+        summarize "$value" "$c" $times >> "$table"
+    done
+
+    echo "Wrote $table" >&2
+}
+
+printf "C\tFS\tPS\n%s\t%s\t%s\n" "$DEFAULT_C" "$FS" "$DEFAULT_PS" \
+    > "$OUT/defaults.tsv"
+
+for name in ${*:-c fer tprop size}; do
+    case $name in
+    c) sweep c C 9600 19200 38400 57600 115200 ;;
+    fer) sweep fer FER 0 0.01 0.02 0.05 0.1 0.2 ;;
+    tprop) sweep tprop d 0 1 5 10 50 100 500 1000 5000 10000 ;;
+    size) sweep size PS 16 32 64 128 256 512 1024 2048 4096 ;;
+    *)
+        echo "Unknown sweep: $name" >&2
+        exit 1
+        ;;
+    esac
+done
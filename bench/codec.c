@@ -0,0 +1,390 @@
+// Microbenchmarks of the frame codec, independent of serial timing
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "byte_vector.h"
+#include "link_layer.h"
+#include "link_layer/fcs.h"
+#include "link_layer/frame.h"
+#include "link_layer/parser.h"
+#include "link_layer/pool.h"
+#include "options.h"
+
+/**
+ * @brief The number of frames encoded or decoded at a time.
+ *
+ * Fits in a #FramePool, so frames and vectors are reused like they are by a
+ * connection.
+ */
+#define BATCH_FRAMES 32
+
+/**
+ * @brief A struct representing a payload of the corpus.
+ */
+typedef struct {
+    /**
+     * @brief The name of the payload.
+     */
+    const char *name;
+    /**
+     * @brief The payload.
+     */
+    uint8_t *data;
+} Payload;
+
+/**
+ * @brief A function measured by the benchmarks, which processes one batch.
+ *
+ * @param payload The payload to process.
+ *
+ * @return The number of frames processed.
+ */
+typedef size_t (*Operation)(const Payload *payload);
+
+/**
+ * @brief The size of the information of each frame.
+ */
+static size_t frame_size;
+/**
+ * @brief How long each benchmark runs for, in seconds.
+ */
+static double duration;
+/**
+ * @brief The connection frames are encoded with.
+ */
+static LLConnection *tx;
+/**
+ * @brief The connection frames are decoded with.
+ */
+static LLConnection *rx;
+/**
+ * @brief Where #write_frame writes to, /dev/null.
+ */
+static int null_fd;
+/**
+ * @brief A batch of encoded frames of the payload being decoded, back to
+ *        back.
+ */
+static ByteVector *wire;
+/**
+ * @brief Keeps results alive, so computing them isn't optimized away.
+ */
+static volatile uint32_t sink;
+
+/**
+ * @brief Returns the current time, in seconds.
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Fills a buffer with pseudo random bytes.
+ */
+void fill_random(uint8_t *buf, size_t len) {
+    uint64_t state = 0x9e3779b97f4a7c15;
+
+    for (size_t i = 0; i < len; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buf[i] = state;
+    }
+}
+
+/**
+ * @brief Fills a buffer with English-like text.
+ */
+void fill_text(uint8_t *buf, size_t len) {
+    static const char *words[] = {
+        "the",  "frame",   "is",     "sent",     "over",   "a",
+        "line", "and",     "each",   "byte",     "of",     "its",
+        "data", "may",     "need",   "to",       "be",     "escaped,",
+        "so",   "the",     "other",  "receiver", "checks", "it.",
+        "Then", "another", "answer", "follows",  "on",     "time\n",
+    };
+    size_t n_words = sizeof(words) / sizeof(words[0]);
+    size_t i = 0, w = 0;
+
+    while (i < len) {
+        const char *word = words[(w * 7 + w / 5) % n_words];
+        ++w;
+
+        for (; *word != '\0' && i < len; ++word)
+            buf[i++] = *word;
+        if (i < len)
+            buf[i++] = ' ';
+    }
+}
+
+/**
+ * @brief Fills a buffer with alternating #FLAG and #ESC bytes, every one of
+ *        which is escaped, doubling the size on the wire.
+ */
+void fill_escapes(uint8_t *buf, size_t len) {
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = i % 2 ? ESC : FLAG;
+}
+
+/**
+ * @brief Encodes a frame of a payload.
+ */
+Frame *encode_payload(const Payload *payload, uint8_t sequence_nr) {
+    Frame *frame = create_frame(tx, I(sequence_nr));
+    struct iovec iov = {.iov_base = payload->data, .iov_len = frame_size};
+
+    encode_frame(tx, frame, &iov, 1);
+
+    return frame;
+}
+
+/**
+ * @brief Stuffs a batch of frames, as #llwritev does.
+ */
+size_t bench_encode(const Payload *payload) {
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        Frame *frame = encode_payload(payload, i);
+        sink += frame->encoded->length;
+        frame_destroy(frame);
+    }
+
+    return BATCH_FRAMES;
+}
+
+/**
+ * @brief Stuffs and writes a batch of frames to /dev/null, to include the
+ *        cost of the syscall.
+ */
+size_t bench_write(const Payload *payload) {
+    tx->fd = null_fd;
+
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        Frame *frame = encode_payload(payload, i);
+        sink += write_frame(tx, frame);
+        frame_destroy(frame);
+    }
+
+    return BATCH_FRAMES;
+}
+
+/**
+ * @brief Parses and destuffs a batch of frames, as #read_frame does.
+ */
+size_t bench_decode(const Payload *payload) {
+    (void)payload;
+
+    parse_frames(rx, wire->array, wire->length);
+
+    size_t n = 0;
+    Frame *frame;
+
+    while ((frame = parser_take(rx)) != NULL) {
+        if (FRAME_TYPE(frame->command) == I(0))
+            n++;
+        frame_destroy(frame);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Computes the frame check sequence of a batch of frames.
+ */
+size_t bench_fcs(const Payload *payload) {
+    uint8_t check[FCS_MAX_SIZE];
+
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        Fcs fcs;
+        fcs_init(&fcs, tx->fcs);
+        fcs_update(&fcs, payload->data, frame_size);
+        fcs_final(&fcs, check);
+        sink += check[0];
+    }
+
+    return BATCH_FRAMES;
+}
+
+/**
+ * @brief Pushes a batch of frames into a vector byte by byte, as frames
+ *        used to be built.
+ */
+size_t bench_pushb(const Payload *payload) {
+    ByteVector *vector = pool_get_vector(&tx->pool);
+
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        bv_clear(vector);
+        for (size_t j = 0; j < frame_size; ++j)
+            bv_pushb(vector, payload->data[j]);
+        sink += vector->length;
+    }
+
+    pool_put_vector(&tx->pool, vector);
+
+    return BATCH_FRAMES;
+}
+
+/**
+ * @brief Pushes a batch of frames into a vector at once.
+ */
+size_t bench_push(const Payload *payload) {
+    ByteVector *vector = pool_get_vector(&tx->pool);
+
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        bv_clear(vector);
+        bv_push(vector, payload->data, frame_size);
+        sink += vector->length;
+    }
+
+    pool_put_vector(&tx->pool, vector);
+
+    return BATCH_FRAMES;
+}
+
+/**
+ * @brief Encodes a batch of frames of a payload into #wire, to be decoded.
+ *
+ * @return The average number of bytes per frame on the wire.
+ */
+double prepare_wire(const Payload *payload) {
+    bv_clear(wire);
+
+    for (int i = 0; i < BATCH_FRAMES; ++i) {
+        Frame *frame = encode_payload(payload, i);
+        bv_push(wire, frame->encoded->array, frame->encoded->length);
+        frame_destroy(frame);
+    }
+
+    return (double)wire->length / BATCH_FRAMES;
+}
+
+/**
+ * @brief Runs an operation repeatedly for #duration seconds and prints its
+ *        throughput.
+ *
+ * @param name The name of the operation.
+ * @param operation The operation.
+ * @param payload The payload.
+ * @param wire_size The size of each frame on the wire.
+ */
+void run(const char *name, Operation operation, const Payload *payload,
+         double wire_size) {
+    size_t frames = 0, expected = 0;
+
+    // Warm up caches and pools
+    operation(payload);
+
+    double start = now(), elapsed;
+
+    do {
+        for (int i = 0; i < 16; ++i) {
+            frames += operation(payload);
+            expected += BATCH_FRAMES;
+        }
+        elapsed = now() - start;
+    } while (elapsed < duration);
+
+    if (frames != expected)
+        fprintf(stderr, "%s/%s: only %lu of %lu frames were intact\n",
+                payload->name, name, frames, expected);
+
+    printf("%s\t%s\t%lu\t%.2f\t%.1f\t%.3f\n", payload->name, name,
+           frame_size, frames * frame_size / elapsed / 1e6,
+           elapsed / frames * 1e9, wire_size / frame_size);
+}
+
+/**
+ * @brief Creates a connection that isn't attached to a serial port.
+ */
+LLConnection *create_connection(LLRole role, LLFcsMode fcs) {
+    LLConnection *connection = calloc(1, sizeof(LLConnection));
+
+    connection->role = role;
+    connection->fcs = fcs;
+    connection->fd = -1;
+    init_control_frames(connection);
+
+    return connection;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [BCC|CRC16|CRC32]\n", argv[0]);
+        return 1;
+    }
+
+    LLFcsMode fcs = FCS_MODE(FCS);
+
+    if (argc == 2) {
+        if (strcmp(argv[1], "BCC") == 0) {
+            fcs = LL_BCC;
+        } else if (strcmp(argv[1], "CRC16") == 0) {
+            fcs = LL_CRC16;
+        } else if (strcmp(argv[1], "CRC32") == 0) {
+            fcs = LL_CRC32;
+        } else {
+            fprintf(stderr, "Unknown frame check sequence: %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    frame_size = option("FRAME_SIZE", 1024);
+    duration = option("DURATION", 0.5);
+
+    tx = create_connection(LL_TX, fcs);
+    rx = create_connection(LL_RX, fcs);
+    wire = bv_create();
+    null_fd = open("/dev/null", O_WRONLY);
+
+    Payload corpus[] = {
+        {.name = "random"},
+        {.name = "zeros"},
+        {.name = "text"},
+        {.name = "escapes"},
+    };
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+        corpus[i].data = calloc(frame_size + BATCH_FRAMES, 1);
+
+    fill_random(corpus[0].data, frame_size + BATCH_FRAMES);
+    fill_text(corpus[2].data, frame_size + BATCH_FRAMES);
+    fill_escapes(corpus[3].data, frame_size + BATCH_FRAMES);
+
+    // The header BCC is only 2 XORs per frame, the BCC2 is what's measured
+    printf("# FCS %s%s\n", fcs_name(fcs),
+           fcs == LL_BCC ? ", fcs computes the BCC2 of the payload" : "");
+    printf("payload\toperation\tframe_size\tMB/s\tns/frame\twire_ratio\n");
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i) {
+        const Payload *payload = &corpus[i];
+        double wire_size = prepare_wire(payload);
+
+        run("encode", bench_encode, payload, wire_size);
+        run("write", bench_write, payload, wire_size);
+        run("decode", bench_decode, payload, wire_size);
+        run("fcs", bench_fcs, payload, frame_size);
+        run("bv_pushb", bench_pushb, payload, frame_size);
+        run("bv_push", bench_push, payload, frame_size);
+
+        free(corpus[i].data);
+    }
+
+    close(null_fd);
+    bv_destroy(wire);
+    pool_destroy(&tx->pool);
+    pool_destroy(&rx->pool);
+    parser_destroy(&rx->parser);
+    free(tx);
+    free(rx);
+
+    return 0;
+}
@@ -0,0 +1,253 @@
+// Emulated serial link, used by the benchmarks
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * @brief How many bytes can be waiting in each direction of the link.
+ */
+#define QUEUE_SIZE 65536
+
+/**
+ * @brief The number of bits sent per byte, with one start and one stop bit.
+ */
+#define BITS_PER_BYTE 10
+
+/**
+ * @brief A struct representing one direction of the link, from the master
+ *        side of one pseudo terminal to the master side of the other.
+ */
+typedef struct {
+    /**
+     * @brief The pseudo terminal bytes are read from.
+     */
+    int from;
+    /**
+     * @brief The pseudo terminal bytes are written to.
+     */
+    int to;
+    /**
+     * @brief The bytes read and not yet written.
+     */
+    uint8_t queue[QUEUE_SIZE];
+    /**
+     * @brief The index of the first byte in the queue.
+     */
+    size_t head;
+    /**
+     * @brief The number of bytes in the queue.
+     */
+    size_t count;
+    /**
+     * @brief How many bytes the line could have sent since the queue stopped
+     *        being empty, and weren't sent yet.
+     */
+    double credit;
+} Direction;
+
+/**
+ * @brief The paths the pseudo terminals are linked to, removed on exit.
+ */
+static const char *paths[2];
+
+/**
+ * @brief Whether a signal asked the link to stop.
+ */
+static volatile sig_atomic_t stopped = false;
+
+/**
+ * @brief Asks the link to stop.
+ *
+ * @param signal The signal received.
+ */
+void handle_signal(int signal) {
+    (void)signal;
+    stopped = true;
+}
+
+/**
+ * @brief Returns the current time, in seconds.
+ */
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Opens a pseudo terminal in raw mode and links its slave side to a
+ *        path.
+ *
+ * @param path Where to link the slave side.
+ * @param slave Where to store a file descriptor of the slave side, which is
+ *              kept open so that the master side doesn't hang up when the
+ *              programs using the link reopen it.
+ *
+ * @return The file descriptor of the master side.
+ * @return -1 on error.
+ */
+int open_pty(const char *path, int *slave) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("posix_openpt");
+        return -1;
+    }
+
+    const char *name = ptsname(master);
+    *slave = open(name, O_RDWR | O_NOCTTY);
+
+    if (*slave == -1) {
+        perror(name);
+        return -1;
+    }
+
+    struct termios termios;
+    tcgetattr(master, &termios);
+    cfmakeraw(&termios);
+    tcsetattr(master, TCSANOW, &termios);
+
+    unlink(path);
+    if (symlink(name, path) == -1) {
+        perror(path);
+        return -1;
+    }
+
+    return master;
+}
+
+/**
+ * @brief Reads as many bytes as fit in the queue of a direction.
+ *
+ * @param d The direction.
+ */
+void fill(Direction *d) {
+    while (d->count < QUEUE_SIZE) {
+        size_t tail = (d->head + d->count) % QUEUE_SIZE;
+        size_t room = tail >= d->head ? QUEUE_SIZE - tail : d->head - tail;
+
+        ssize_t n = read(d->from, d->queue + tail, room);
+
+        if (n <= 0)
+            return;
+
+        // The line was idle, so it can't have sent anything in the meantime
+        if (d->count == 0)
+            d->credit = 0;
+
+        d->count += n;
+    }
+}
+
+/**
+ * @brief Writes the bytes the line had time to send.
+ *
+ * @param d The direction.
+ * @param elapsed How long it has been since the last call, in seconds.
+ * @param byte_rate How many bytes the line sends per second.
+ */
+void drain(Direction *d, double elapsed, double byte_rate) {
+    if (d->count == 0)
+        return;
+
+    d->credit += elapsed * byte_rate;
+
+    while (d->count > 0 && d->credit >= 1) {
+        size_t n = d->credit;
+
+        if (n > d->count)
+            n = d->count;
+        if (n > QUEUE_SIZE - d->head)
+            n = QUEUE_SIZE - d->head;
+
+        ssize_t written = write(d->to, d->queue + d->head, n);
+
+        // The other side isn't reading, retry later
+        if (written <= 0)
+            return;
+
+        d->head = (d->head + written) % QUEUE_SIZE;
+        d->count -= written;
+        d->credit -= written;
+    }
+}
+
+/**
+ * @brief Removes the links to the pseudo terminals.
+ */
+void cleanup(void) {
+    for (int i = 0; i < 2; ++i)
+        if (paths[i] != NULL)
+            unlink(paths[i]);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s TX_PATH RX_PATH BAUDRATE\n", argv[0]);
+        return 1;
+    }
+
+    double byte_rate = atof(argv[3]) / BITS_PER_BYTE;
+
+    if (byte_rate <= 0) {
+        fprintf(stderr, "Invalid baudrate: %s\n", argv[3]);
+        return 1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    atexit(cleanup);
+
+    int slaves[2], masters[2];
+
+    for (int i = 0; i < 2; ++i) {
+        masters[i] = open_pty(argv[i + 1], &slaves[i]);
+        if (masters[i] == -1)
+            return 1;
+        paths[i] = argv[i + 1];
+    }
+
+    static Direction directions[2];
+    directions[0] = (Direction){.from = masters[0], .to = masters[1]};
+    directions[1] = (Direction){.from = masters[1], .to = masters[0]};
+
+    double last = now();
+
+    while (!stopped) {
+        bool pending = directions[0].count > 0 || directions[1].count > 0;
+
+        struct pollfd fds[2] = {
+            {.fd = masters[0], .events = POLLIN},
+            {.fd = masters[1], .events = POLLIN},
+        };
+
+        // Wake up often enough to pace what's pending
+        if (poll(fds, 2, pending ? 1 : 100) == -1 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+
+        double t = now();
+
+        for (int i = 0; i < 2; ++i) {
+            drain(&directions[i], t - last, byte_rate);
+            fill(&directions[i]);
+        }
+
+        last = t;
+    }
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+#ifndef _BOND_H_
+#define _BOND_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "byte_vector.h"
+#include "link_layer.h"
+
+/**
+ * @brief The largest number of serial ports a bond can stripe packets
+ *        across.
+ */
+#ifndef BOND_MAX_LINKS
+#define BOND_MAX_LINKS 8
+#endif
+
+/**
+ * @brief How many packets can be sent ahead of the oldest one that wasn't
+ *        acknowledged, which is also how far packets can arrive out of order.
+ */
+#ifndef BOND_WINDOW
+#define BOND_WINDOW 64
+#endif
+
+#if BOND_WINDOW < SEQ_MODULO
+#error "BOND_WINDOW must be at least SEQ_MODULO"
+#endif
+
+/**
+ * @brief How many times #TIMEOUT seconds the receiver waits for a link to be
+ *        closed by the transmitter, once the bond is being closed, before
+ *        giving up on it.
+ *
+ * By then the transmitter gave up on the links that went silent, and closed
+ * the others.
+ */
+#ifndef BOND_CLOSE_TRIES
+#define BOND_CLOSE_TRIES (N_TRIES + 1)
+#endif
+
+/**
+ * @brief The separator of the serial ports of a bond.
+ */
+#define BOND_SEPARATOR ","
+
+/**
+ * @brief The size of the header of the packets sent through a bond of more
+ *        than one link, their index as 4 little endian bytes.
+ */
+#define BOND_HEADER_SIZE 4
+
+/**
+ * @brief A struct representing a connection striped across several serial
+ *        ports.
+ */
+typedef struct _Bond Bond;
+
+/**
+ * @brief A struct representing one of the serial ports of a bond.
+ */
+typedef struct {
+    /**
+     * @brief The bond the serial port is part of.
+     */
+    Bond *bond;
+    /**
+     * @brief The connection through the serial port, only used by #thread
+     *        while it runs.
+     */
+    LLConnection *connection;
+    /**
+     * @brief The thread sending or receiving packets through the connection.
+     */
+    pthread_t thread;
+    /**
+     * @brief Whether #thread was started.
+     */
+    bool started;
+    /**
+     * @brief Whether the connection failed, or was closed by the other side.
+     */
+    bool failed;
+    /**
+     * @brief The indexes of the last packets sent through the connection,
+     *        by their number modulo #SEQ_MODULO.
+     */
+    uint32_t sent[SEQ_MODULO];
+    /**
+     * @brief The number of packets sent through the connection.
+     */
+    size_t n_sent;
+    /**
+     * @brief How many of the last packets #sent weren't acknowledged yet,
+     *        see #llpending.
+     */
+    size_t pending;
+    /**
+     * @brief Whether the connection is sending a packet, #sending.
+     */
+    bool busy;
+    /**
+     * @brief The index of the packet being sent, if #busy.
+     */
+    uint32_t sending;
+    /**
+     * @brief The frame error ratio of the connection, see #llerror_rate.
+     */
+    double fer;
+} BondLink;
+
+/**
+ * @brief A struct representing a packet of a bond, see #Bond::slots.
+ */
+typedef struct {
+    /**
+     * @brief The packet.
+     */
+    ByteVector *data;
+    /**
+     * @brief The index of the packet.
+     */
+    uint32_t index;
+    /**
+     * @brief Whether the slot holds a packet that arrived and wasn't read,
+     *        on the receiver.
+     */
+    bool full;
+} BondSlot;
+
+/**
+ * @brief A struct representing a connection striped across several serial
+ *        ports, each with its own link layer connection and retransmissions.
+ *
+ * Packets are numbered in the order they're written and sent by a thread per
+ * link, each taking the next one as soon as its window has room, so that
+ * faster links send more of them. The receiver puts them back in order
+ * before they're read. The packets that a link that fails didn't get
+ * acknowledged are sent again through the others.
+ *
+ * A bond of a single serial port uses its connection directly instead.
+ */
+struct _Bond {
+    /**
+     * @brief The role of this side of the bond.
+     */
+    LLRole role;
+    /**
+     * @brief Whether more than one serial port was given, so packets are
+     *        numbered and striped across #links, even if only one opened.
+     */
+    bool striped;
+    /**
+     * @brief The links of the bond.
+     */
+    BondLink links[BOND_MAX_LINKS];
+    /**
+     * @brief The number of #links.
+     */
+    size_t n_links;
+    /**
+     * @brief The number of #links that didn't fail.
+     */
+    size_t n_alive;
+    /**
+     * @brief The errno of the last link that failed.
+     */
+    int error;
+    /**
+     * @brief Protects the state of the bond, but not the connections.
+     */
+    pthread_mutex_t lock;
+    /**
+     * @brief Signalled when packets are written, acknowledged, arrive or are
+     *        read, or a link fails.
+     */
+    pthread_cond_t changed;
+    /**
+     * @brief The packets written and not yet acknowledged, on the
+     *        transmitter, or the ones that arrived out of order, on the
+     *        receiver, by their index modulo #BOND_WINDOW.
+     */
+    BondSlot slots[BOND_WINDOW];
+    /**
+     * @brief The index of the next packet to write, on the transmitter, or to
+     *        read, on the receiver.
+     */
+    uint32_t next_index;
+    /**
+     * @brief The index of the next packet that no link took yet.
+     */
+    uint32_t next_unsent;
+    /**
+     * @brief The indexes of the packets to send again, that a link failed to
+     *        get acknowledged.
+     */
+    uint32_t retries[BOND_WINDOW];
+    /**
+     * @brief The number of #retries.
+     */
+    size_t n_retries;
+    /**
+     * @brief Whether the bond is being closed, so links stop once they have
+     *        nothing left to send.
+     */
+    bool closing;
+    /**
+     * @brief Whether the receiver disconnects every link, see
+     *        #bond_disconnect.
+     */
+    bool disconnecting;
+};
+
+/**
+ * @brief Opens a bond through one or more serial ports.
+ *
+ * @note Ports that can't be opened are left out, as long as one of them is.
+ *
+ * @param serial_ports The serial ports, separated by #BOND_SEPARATOR. Both
+ *                     sides must give the same number of them.
+ * @param role The role of this side of the bond.
+ *
+ * @return The bond.
+ * @return NULL on error.
+ */
+Bond *bond_open(const char *serial_ports, LLRole role);
+
+/**
+ * @brief Sends a packet through a bond.
+ *
+ * @note Blocks until the packet is at most #BOND_WINDOW packets ahead of the
+ *       oldest one that wasn't acknowledged.
+ *
+ * @param bond The bond.
+ * @param iov The buffers of the packet, which don't need to outlive the
+ *            call.
+ * @param iovcnt The number of buffers.
+ *
+ * @return The size of the packet.
+ * @return Negative on error, once every link failed, with errno set to the
+ *         error of the last one, see #llwritev.
+ */
+ssize_t bond_writev(Bond *bond, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Receives the next packet from a bond, in the order they were sent.
+ *
+ * @param bond The bond.
+ * @param buf Where to store the packet.
+ * @param buf_size The size of buf.
+ *
+ * @return The size of the packet.
+ * @return Negative on error, once every link failed or was closed, or if the
+ *         packet doesn't fit in buf, in which case it's dropped.
+ */
+ssize_t bond_read_into(Bond *bond, uint8_t *buf, size_t buf_size);
+
+/**
+ * @brief Counts the packets sent through a bond since the oldest one that
+ *        wasn't acknowledged, see #llpending.
+ *
+ * @param bond The bond.
+ *
+ * @return The number of packets.
+ */
+size_t bond_pending(Bond *bond);
+
+/**
+ * @brief Waits for every packet sent through a bond to be acknowledged, see
+ *        #llsync.
+ *
+ * @param bond The bond.
+ *
+ * @return 0 on success.
+ * @return -1 on error, once every link failed, with errno set to the error of
+ *         the last one.
+ */
+int bond_flush(Bond *bond);
+
+/**
+ * @brief Estimates how many of the frames sent through a bond are lost or
+ *        damaged, on average over its links, see #llerror_rate.
+ *
+ * @param bond The bond.
+ *
+ * @return The estimated frame error ratio, between 0 and 1.
+ */
+double bond_error_rate(Bond *bond);
+
+/**
+ * @brief Disconnects every link of a bond from the transmitter before it's
+ *        done, see #lldisconnect.
+ *
+ * @note Links of a bond of more than one serial port disconnect once they
+ *       receive their next packet.
+ *
+ * @param bond The bond.
+ */
+void bond_disconnect(Bond *bond);
+
+/**
+ * @brief Waits for every packet sent through a bond to be acknowledged,
+ *        closes every link and deallocates it.
+ *
+ * @note Links that failed are closed without a disconnect handshake, the
+ *       other side wouldn't answer it.
+ *
+ * @param bond The bond.
+ * @param show_stats Whether and how to print the statistics of each link,
+ *                   see #llclose.
+ */
+void bond_close(Bond *bond, LLStatsFormat show_stats);
+
+#endif // _BOND_H_
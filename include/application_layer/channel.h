@@ -0,0 +1,246 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "application_layer/bond.h"
+#include "application_layer/checkpoint.h"
+#include "application_layer/reader.h"
+#include "application_layer/writer.h"
+
+/**
+ * @brief The largest number of files sent at once, each through its own
+ *        channel.
+ */
+#ifndef MAX_CHANNELS
+#define MAX_CHANNELS 8
+#endif
+
+/**
+ * @brief The separator of the files sent at once.
+ */
+#define CHANNEL_SEPARATOR ","
+
+/**
+ * @brief The separator of the weight and rate cap of a file from its name,
+ *        see #parse_channels.
+ */
+#define CHANNEL_OPTION_SEPARATOR ":"
+
+/**
+ * @brief A struct representing a file being sent through its own channel,
+ *        interleaved with the others by weighted fair queueing.
+ */
+typedef struct {
+    /**
+     * @brief The id of the channel, sent in every packet.
+     */
+    uint8_t id;
+    /**
+     * @brief The name of the file.
+     */
+    char file_name[PATH_MAX];
+    /**
+     * @brief The share of the link the channel gets when others are sending
+     *        too, relative to theirs.
+     */
+    double weight;
+    /**
+     * @brief The most bytes per second the channel sends, 0 for no cap.
+     */
+    double rate;
+    /**
+     * @brief The file descriptor of the file.
+     */
+    int fd;
+    /**
+     * @brief The reader of the file.
+     */
+    FileReader *reader;
+    /**
+     * @brief The size of the fragments read from the file.
+     */
+    size_t fragment_size;
+    /**
+     * @brief The sequence number of the next DATA packet.
+     */
+    uint8_t sequence_number;
+    /**
+     * @brief The path of the checkpoint of the file.
+     */
+    char checkpoint[PATH_MAX];
+    /**
+     * @brief The #checkpoint_hash of the file up to #start.
+     */
+    uint8_t prefix_hash[PREFIX_HASH_SIZE];
+    /**
+     * @brief Where in the file the first DATA packet starts.
+     */
+    off_t start;
+    /**
+     * @brief The offset last recorded in the #checkpoint.
+     */
+    off_t saved;
+    /**
+     * @brief Whether the #checkpoint is kept once the channel is closed,
+     *        because the file wasn't sent entirely.
+     */
+    bool keep_checkpoint;
+    /**
+     * @brief The number of the packet, among every packet of every channel,
+     *        of each of the last DATA packets sent, by their number modulo
+     *        #BOND_WINDOW.
+     */
+    uint64_t numbers[BOND_WINDOW];
+    /**
+     * @brief The offset in the file past each of the last DATA packets sent,
+     *        by their number modulo #BOND_WINDOW.
+     */
+    off_t ends[BOND_WINDOW];
+    /**
+     * @brief The number of DATA packets sent.
+     */
+    size_t n_sent;
+    /**
+     * @brief The virtual time at which the last packet of the channel
+     *        finished, see #schedule_channel.
+     */
+    double finish;
+    /**
+     * @brief When the channel can send again without going over its #rate,
+     *        in seconds.
+     */
+    double next_allowed;
+    /**
+     * @brief Whether the channel sent its END packet.
+     */
+    bool done;
+} TxChannel;
+
+/**
+ * @brief A struct representing a file being received through its own
+ *        channel.
+ */
+typedef struct {
+    /**
+     * @brief The name of the file.
+     */
+    char file_name[256 + 9]; // Give space for "_received"
+    /**
+     * @brief The path of the checkpoint of the file.
+     */
+    char checkpoint[256 + 9 + sizeof(CHECKPOINT_SUFFIX)];
+    /**
+     * @brief The file descriptor of the file, -1 until its START packet.
+     */
+    int fd;
+    /**
+     * @brief The writer of the file.
+     */
+    FileWriter *writer;
+    /**
+     * @brief The expected size of the file.
+     */
+    size_t file_size;
+    /**
+     * @brief Where in the file the first DATA packet starts.
+     */
+    off_t resume_offset;
+    /**
+     * @brief The transmitter's #checkpoint_hash of the file up to
+     *        #resume_offset.
+     */
+    uint8_t prefix_hash[PREFIX_HASH_SIZE];
+    /**
+     * @brief The #CompressionMethod of the COMPRESSED_DATA packets.
+     */
+    uint8_t compression;
+    /**
+     * @brief The largest data fragment of the DATA packets.
+     */
+    size_t max_fragment_size;
+    /**
+     * @brief Where compressed fragments are decompressed.
+     */
+    uint8_t *fragment;
+    /**
+     * @brief The sequence number of the next DATA packet.
+     */
+    uint8_t sequence_number;
+    /**
+     * @brief Whether the END packet arrived.
+     */
+    bool complete;
+} RxChannel;
+
+/**
+ * @brief A struct representing the weighted fair queueing of the channels of
+ *        a transmitter.
+ *
+ * Each packet is tagged with a virtual start time, the later of when the
+ * previous packet of its channel finished and the start of the packet sent
+ * last, and finishes its size divided by its channel's weight after that.
+ * The packet with the earliest start is sent first, so that backlogged
+ * channels share the link in proportion to their weights, and a channel
+ * that was idle can't make up for it.
+ */
+typedef struct {
+    /**
+     * @brief The channels.
+     */
+    TxChannel channels[MAX_CHANNELS];
+    /**
+     * @brief The number of #channels.
+     */
+    size_t n_channels;
+    /**
+     * @brief The virtual start time of the packet sent last.
+     */
+    double virtual_time;
+} Scheduler;
+
+/**
+ * @brief Parses the files to send at once into the channels of a scheduler.
+ *
+ * Files are separated by #CHANNEL_SEPARATOR, and each can be followed by its
+ * weight and rate cap in bytes per second, separated by
+ * #CHANNEL_OPTION_SEPARATOR, e.g. "big.bin,urgent.txt:8,log.txt:1:2000".
+ *
+ * @param scheduler The scheduler.
+ * @param files The files.
+ *
+ * @return The number of channels.
+ */
+size_t parse_channels(Scheduler *scheduler, const char *files);
+
+/**
+ * @brief Picks the channel whose next packet is sent, among those that
+ *        didn't finish and aren't over their rate cap.
+ *
+ * @param scheduler The scheduler.
+ * @param now The current time, in seconds.
+ * @param wait Where to write how many seconds until a channel is under its
+ *             rate cap again, if none can send now.
+ *
+ * @return The channel.
+ * @return NULL if none can send now, or every channel finished, in which
+ *         case wait is 0.
+ */
+TxChannel *schedule_channel(Scheduler *scheduler, double now, double *wait);
+
+/**
+ * @brief Accounts for a packet that a channel sent.
+ *
+ * @param scheduler The scheduler.
+ * @param channel The channel, returned by #schedule_channel.
+ * @param size The size of the packet.
+ * @param now The current time, in seconds.
+ */
+void charge_channel(Scheduler *scheduler, TxChannel *channel, size_t size,
+                    double now);
+
+#endif // _CHANNEL_H_
@@ -0,0 +1,69 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * @brief How many bytes of a file are transferred between checkpoints.
+ */
+#ifndef CHECKPOINT_INTERVAL
+#define CHECKPOINT_INTERVAL 65536
+#endif
+
+/**
+ * @brief The suffix of the name of a checkpoint, after the name of the file
+ *        it's about.
+ */
+#define CHECKPOINT_SUFFIX ".resume"
+
+/**
+ * @brief The size of the hash of the prefix of a file, see #checkpoint_hash.
+ */
+#define PREFIX_HASH_SIZE 4
+
+/**
+ * @brief Builds the path of the checkpoint of a file.
+ *
+ * @param dst Where to write the path.
+ * @param size The size of dst.
+ * @param file_name The path of the file.
+ */
+void checkpoint_path(char *dst, size_t size, const char *file_name);
+
+/**
+ * @brief Reads a checkpoint, how many bytes of a file are known to be
+ *        transferred.
+ *
+ * @param path The path of the checkpoint.
+ *
+ * @return The number of bytes.
+ * @return 0 if there's no checkpoint, or it's malformed.
+ */
+off_t checkpoint_read(const char *path);
+
+/**
+ * @brief Writes a checkpoint, replacing the previous one at once, so that a
+ *        crash leaves either of them.
+ *
+ * @param path The path of the checkpoint.
+ * @param offset How many bytes of the file are known to be transferred.
+ *
+ * @return -1 on error.
+ */
+int checkpoint_write(const char *path, off_t offset);
+
+/**
+ * @brief Hashes the first bytes of a file, with a CRC-32, so that both sides
+ *        can check that they have the same prefix.
+ *
+ * @param fd The file descriptor of the file, whose offset isn't changed.
+ * @param length How many bytes to hash.
+ * @param hash Where to write the #PREFIX_HASH_SIZE bytes of the hash.
+ *
+ * @return -1 on error, or if the file is shorter than length.
+ */
+int checkpoint_hash(int fd, off_t length, uint8_t *hash);
+
+#endif // _CHECKPOINT_H_
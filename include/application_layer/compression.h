@@ -0,0 +1,109 @@
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+/**
+ * @brief Whether DATA packets are compressed, 0 or 1.
+ */
+#ifndef COMPRESSION
+#define COMPRESSION 1
+#endif
+
+/**
+ * @brief How many threads compress file fragments, 0 for one per core.
+ */
+#ifndef COMPRESS_THREADS
+#define COMPRESS_THREADS 0
+#endif
+
+/**
+ * @brief The estimated entropy, in bits per byte, above which a block isn't
+ *        worth compressing.
+ *
+ * Already compressed data, such as JPEGs, sits just below 8.
+ */
+#ifndef ENTROPY_THRESHOLD
+#define ENTROPY_THRESHOLD 7.5
+#endif
+
+/**
+ * @brief An enum representing the compression methods a transmitter can
+ *        announce in the START packet.
+ *
+ * The values are sent, so they must not change.
+ */
+typedef enum {
+    /**
+     * @brief Blocks are sent as they are.
+     */
+    COMPRESSION_NONE = 0,
+    /**
+     * @brief Blocks are compressed independently, with #lz_compress.
+     */
+    COMPRESSION_LZ = 1,
+} CompressionMethod;
+
+/**
+ * @brief Estimates how compressible a block is, from the frequency of its
+ *        bytes.
+ *
+ * @param buf The block.
+ * @param len The size of the block.
+ *
+ * @return The entropy of the block, in bits per byte.
+ */
+double lz_entropy(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Compresses a block into a sequence of literal runs and matches
+ *        against earlier bytes of the same block, LZ4 style.
+ *
+ * @note Blocks are compressed independently, so they can be compressed in
+ *       parallel and decompressed without any other block.
+ *
+ * @param dst Where to write the compressed block.
+ * @param capacity The size of dst.
+ * @param src The block, at most 64KiB.
+ * @param len The size of the block.
+ *
+ * @return The size of the compressed block.
+ * @return 0 if it doesn't fit in dst.
+ */
+size_t lz_compress(uint8_t *dst, size_t capacity, const uint8_t *src,
+                   size_t len);
+
+/**
+ * @brief Decompresses a block compressed by #lz_compress.
+ *
+ * @note Never reads or writes out of bounds, even if the block is malformed.
+ *
+ * @param dst Where to write the block.
+ * @param capacity The size of dst.
+ * @param src The compressed block.
+ * @param len The size of the compressed block.
+ *
+ * @return The size of the block.
+ * @return -1 if the compressed block is malformed or doesn't fit in dst.
+ */
+ssize_t lz_decompress(uint8_t *dst, size_t capacity, const uint8_t *src,
+                      size_t len);
+
+/**
+ * @brief Compresses a block, unless that isn't worth it.
+ *
+ * @param dst Where to write the compressed block.
+ * @param capacity The size of dst.
+ * @param src The block.
+ * @param len The size of the block.
+ *
+ * @return The size of the compressed block.
+ * @return 0 if the block should be sent as it is, because its entropy is
+ *         above #ENTROPY_THRESHOLD or it didn't get any smaller.
+ */
+size_t compress_block(uint8_t *dst, size_t capacity, const uint8_t *src,
+                      size_t len);
+
+#endif // _COMPRESSION_H_
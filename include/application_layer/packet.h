@@ -1,9 +1,13 @@
 #ifndef _PACKET_H_
 #define _PACKET_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "application_layer/bond.h"
+#include "application_layer/checkpoint.h"
+#include "application_layer/compression.h"
 #include "byte_vector.h"
 #include "link_layer.h"
 
@@ -14,11 +18,44 @@
 #define PACKET_DATA_SIZE 1024
 #endif
 
+/**
+ * @brief The smallest size of the data fragment of a DATA packet, when the
+ *        size is adapted to the frame error ratio.
+ */
+#ifndef MIN_PACKET_DATA_SIZE
+#define MIN_PACKET_DATA_SIZE 128
+#endif
+
+#if MIN_PACKET_DATA_SIZE > PACKET_DATA_SIZE
+#error "MIN_PACKET_DATA_SIZE must be at most PACKET_DATA_SIZE"
+#endif
+
+/**
+ * @brief Whether the transmitted and received files are memory mapped,
+ *        instead of read and written.
+ */
+#ifndef MMAP
+#define MMAP 0
+#endif
+
+/**
+ * @brief the size of the header of a DATA packet: its type, channel, sequence
+ *        number and the size of its data fragment.
+ */
+#define DATA_HEADER_SIZE 5
+
 /**
  * @brief the size of a complete packet, including packet header and packet
  *        body.
  */
-#define PACKET_SIZE PACKET_DATA_SIZE + 4
+#define PACKET_SIZE (PACKET_DATA_SIZE + DATA_HEADER_SIZE)
+
+/**
+ * @brief the largest size of a START packet, with every field.
+ */
+#define START_PACKET_SIZE                                                      \
+    (2 + 2 + sizeof(size_t) + 2 + 255 + 3 + 4 + 2 + sizeof(off_t) + 2 +       \
+     PREFIX_HASH_SIZE + 3)
 
 /**
  * @brief A DATA packet, containing a data fragment to be transmitted over the
@@ -36,6 +73,12 @@
  */
 #define END_PACKET (uint8_t)3
 
+/**
+ * @brief A COMPRESSED_DATA packet, a DATA packet whose data fragment was
+ *        compressed with the method announced in the START packet.
+ */
+#define COMPRESSED_DATA_PACKET (uint8_t)4
+
 /**
  * @brief the FILE_SIZE field in a START packet.
  */
@@ -46,41 +89,112 @@
  */
 #define FILE_NAME_FIELD (uint8_t)2
 
+/**
+ * @brief the COMPRESSION field in a START packet, the #CompressionMethod of
+ *        the COMPRESSED_DATA packets that follow.
+ */
+#define COMPRESSION_FIELD (uint8_t)3
+
+/**
+ * @brief the FRAGMENT_SIZE field in a START packet, the largest data fragment
+ *        of the DATA packets that follow.
+ */
+#define FRAGMENT_SIZE_FIELD (uint8_t)4
+
+/**
+ * @brief the RESUME_OFFSET field in a START packet, where in the file the
+ *        DATA packets that follow start, if not at its start.
+ */
+#define RESUME_OFFSET_FIELD (uint8_t)5
+
+/**
+ * @brief the PREFIX_HASH field in a START packet, the #checkpoint_hash of the
+ *        file up to the RESUME_OFFSET, which the receiver must already have.
+ */
+#define PREFIX_HASH_FIELD (uint8_t)6
+
+/**
+ * @brief the CHANNELS field in a START packet, how many files are sent at
+ *        once, each through its own channel.
+ */
+#define CHANNELS_FIELD (uint8_t)7
+
 /**
  * @brief Create a START packet.
  *
+ * @param channel The channel of the file.
+ * @param n_channels The number of files sent at once.
  * @param file_size The size of the file to transmit.
  * @param file_name The name of the file to transmit.
+ * @param compression The compression method of the DATA packets, only
+ *                    announced if not #COMPRESSION_NONE.
+ * @param max_fragment_size The largest data fragment of the DATA packets.
+ * @param resume_offset Where in the file the DATA packets start, only
+ *                      announced if not 0.
+ * @param prefix_hash The #checkpoint_hash of the file up to resume_offset.
  *
  * @return A ByteVector object containing the packet bytes.
  */
-ByteVector *create_start_packet(size_t file_size, const char *file_name);
+ByteVector *create_start_packet(uint8_t channel, uint8_t n_channels,
+                                size_t file_size, const char *file_name,
+                                uint8_t compression,
+                                uint16_t max_fragment_size,
+                                off_t resume_offset,
+                                const uint8_t *prefix_hash);
 
 /**
- * @brief Create a DATA packet.
+ * @brief Create an END packet.
  *
- * @param buf The data to send.
- * @param size The size of the data to send.
+ * @param channel The channel of the file that was sent.
  *
  * @return A ByteVector object containing the packet bytes.
  */
-ByteVector *create_data_packet(const uint8_t *buf, uint16_t size);
+ByteVector *create_end_packet(uint8_t channel);
 
 /**
- * @brief Create an END packet.
+ * @brief Sends the specified packet through the specified bond.
  *
- * @return A ByteVector object containing the packet bytes.
+ * @param bond The bond to send data through.
+ * @param packet The packet to send.
+ *
+ * @return The number of bytes sent.
  */
-ByteVector *create_end_packet();
+ssize_t send_packet(Bond *bond, ByteVector *packet);
 
 /**
- * @brief Sends the specified packet using the specified connection object.
+ * @brief Sends a DATA packet through the specified bond.
  *
- * @param connection The connection to send data to.
- * @param packet The packet to send.
+ * @note The data isn't copied into the packet, its header and the data are
+ *       sent together with #bond_writev.
+ *
+ * @param bond The bond to send data through.
+ * @param channel The channel of the file the data is from.
+ * @param sequence_number The sequence number of the packet in its channel.
+ * @param buf The data to send.
+ * @param size The size of the data to send.
+ * @param compressed Whether the data was compressed, and is sent in a
+ *                   COMPRESSED_DATA packet.
  *
  * @return The number of bytes sent.
  */
-ssize_t send_packet(LLConnection *connection, ByteVector *packet);
+ssize_t send_data_packet(Bond *bond, uint8_t channel, uint8_t sequence_number,
+                         const uint8_t *buf, uint16_t size, bool compressed);
+
+/**
+ * @brief Picks the size of data fragments that maximizes goodput, for a
+ *        frame error ratio measured with fragments of a given size.
+ *
+ * Assumes errors hit bytes independently, so that larger frames are more
+ * likely to be damaged, but carry relatively less overhead.
+ *
+ * @param fer The frame error ratio, see #llerror_rate.
+ * @param fragment_size The size of the fragments it was measured with.
+ * @param max_size The largest size allowed, at most #PACKET_DATA_SIZE.
+ *
+ * @return The size of the next fragments, between #MIN_PACKET_DATA_SIZE, or
+ *         max_size if it is smaller, and max_size.
+ */
+size_t adapt_fragment_size(double fer, size_t fragment_size,
+                           size_t max_size);
 
 #endif // _PACKET_H_
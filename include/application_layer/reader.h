@@ -0,0 +1,197 @@
+#ifndef _READER_H_
+#define _READER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "application_layer/compression.h"
+#include "application_layer/packet.h"
+
+/**
+ * @brief How many file fragments can be read ahead of the one being sent.
+ */
+#ifndef READ_AHEAD
+#define READ_AHEAD 8
+#endif
+
+/**
+ * @brief A struct representing a file being read ahead of its transmission,
+ *        by a background thread, into a ring of fragments.
+ *
+ * If fragments are compressed, a pool of worker threads compresses the
+ * fragments that were read, each one independently, so that several can be
+ * compressed at once.
+ *
+ * If #MMAP is set and fragments aren't compressed, the file is mapped into
+ * memory instead, and fragments point straight into the mapping.
+ */
+typedef struct {
+    /**
+     * @brief The file descriptor of the file being read.
+     */
+    int fd;
+    /**
+     * @brief The file mapped into memory, or NULL if it is being read.
+     */
+    uint8_t *mapping;
+    /**
+     * @brief The size of the #mapping.
+     */
+    size_t mapping_size;
+    /**
+     * @brief The offset in the file past the last fragment returned by
+     *        #reader_next, where the next one starts in the #mapping.
+     */
+    size_t position;
+    /**
+     * @brief Whether fragments are compressed, see #compress_block.
+     */
+    bool compress;
+    /**
+     * @brief The size of the fragments read from now on, at most
+     *        #PACKET_DATA_SIZE.
+     */
+    size_t fragment_size;
+    /**
+     * @brief The thread reading the file.
+     */
+    pthread_t thread;
+    /**
+     * @brief The threads compressing fragments.
+     */
+    pthread_t workers[READ_AHEAD];
+    /**
+     * @brief The number of #workers.
+     */
+    size_t n_workers;
+    /**
+     * @brief Protects the state of the ring.
+     */
+    pthread_mutex_t lock;
+    /**
+     * @brief Signalled when a fragment is ready to be sent.
+     */
+    pthread_cond_t not_empty;
+    /**
+     * @brief Signalled when a fragment is read, for the workers to compress.
+     */
+    pthread_cond_t readable;
+    /**
+     * @brief Signalled when a fragment is released.
+     */
+    pthread_cond_t not_full;
+    /**
+     * @brief The ring of fragments.
+     */
+    uint8_t fragments[READ_AHEAD][PACKET_DATA_SIZE];
+    /**
+     * @brief The result of reading each fragment, its size, 0 at the end of
+     *        the file or -1 on error.
+     */
+    ssize_t sizes[READ_AHEAD];
+    /**
+     * @brief The compressed version of each fragment.
+     */
+    uint8_t blocks[READ_AHEAD][PACKET_DATA_SIZE];
+    /**
+     * @brief The size of each compressed fragment, 0 if the fragment is sent
+     *        as it is.
+     */
+    size_t block_sizes[READ_AHEAD];
+    /**
+     * @brief Whether each fragment is ready to be sent, read and compressed.
+     */
+    bool done[READ_AHEAD];
+    /**
+     * @brief The index of the oldest fragment that was read and not released.
+     */
+    size_t head;
+    /**
+     * @brief The number of fragments that were read and not released.
+     */
+    size_t count;
+    /**
+     * @brief The number of fragments, from #head, that a worker started
+     *        compressing.
+     */
+    size_t claimed;
+    /**
+     * @brief Whether the thread should stop reading.
+     */
+    bool stop;
+} FileReader;
+
+/**
+ * @brief Starts reading a file ahead in the background.
+ *
+ * @param fd The file descriptor of the file, read from its current offset.
+ * @param compress Whether to compress the fragments, with #COMPRESS_THREADS
+ *                 threads.
+ * @param fragment_size The size of the first fragments, at most
+ *                      #PACKET_DATA_SIZE.
+ *
+ * @return The newly created reader.
+ * @return NULL on error.
+ */
+FileReader *reader_create(int fd, bool compress, size_t fragment_size);
+
+/**
+ * @brief Waits for the next fragment of a file.
+ *
+ * @note The fragment must be released with #reader_release before the next
+ *       one is requested.
+ *
+ * @param reader The reader.
+ * @param fragment Where to store a pointer to the fragment.
+ * @param compressed Where to store whether the fragment was compressed.
+ *
+ * @return The size of the fragment.
+ * @return 0 at the end of the file.
+ * @return -1 on error.
+ */
+ssize_t reader_next(FileReader *reader, const uint8_t **fragment,
+                    bool *compressed);
+
+/**
+ * @brief Releases the last fragment returned by #reader_next, so that it can
+ *        be reused.
+ *
+ * @note Fragments from a mapping stay valid until the reader is destroyed.
+ *
+ * @param reader The reader.
+ */
+void reader_release(FileReader *reader);
+
+/**
+ * @brief Gets the offset in a file past the last fragment returned by
+ *        #reader_next.
+ *
+ * @param reader The reader.
+ *
+ * @return The offset.
+ */
+off_t reader_offset(const FileReader *reader);
+
+/**
+ * @brief Changes the size of the fragments of a file.
+ *
+ * @note Fragments that were already read ahead keep their size.
+ *
+ * @param reader The reader.
+ * @param size The size of the next fragments, at most #PACKET_DATA_SIZE.
+ */
+void reader_set_fragment_size(FileReader *reader, size_t size);
+
+/**
+ * @brief Stops reading a file and deallocates a reader.
+ *
+ * @note Doesn't close the file.
+ *
+ * @param reader The reader.
+ */
+void reader_destroy(FileReader *reader);
+
+#endif // _READER_H_
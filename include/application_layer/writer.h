@@ -0,0 +1,151 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "application_layer/packet.h"
+
+/**
+ * @brief How many received file fragments can be waiting to be written.
+ */
+#ifndef WRITE_BEHIND
+#define WRITE_BEHIND 64
+#endif
+
+/**
+ * @brief How many file fragments are written together, unless the file is
+ *        finished first.
+ */
+#ifndef WRITE_BATCH
+#define WRITE_BATCH 16
+#endif
+
+#if WRITE_BATCH > WRITE_BEHIND
+#error "WRITE_BATCH must be at most WRITE_BEHIND"
+#endif
+
+/**
+ * @brief A struct representing a file being written behind its reception, by
+ *        a background thread, from a ring of fragments.
+ *
+ * If #MMAP is set, the file is sized up front and mapped into memory
+ * instead, and fragments are copied to their place in the mapping.
+ *
+ * Every #CHECKPOINT_INTERVAL bytes, and when it's destroyed, the writer
+ * flushes the file to disk and records how much of it is there in its
+ * checkpoint, so that the transfer can be resumed.
+ */
+typedef struct {
+    /**
+     * @brief The file descriptor of the file being written.
+     */
+    int fd;
+    /**
+     * @brief The file mapped into memory, or NULL if it is being written.
+     */
+    uint8_t *mapping;
+    /**
+     * @brief The size of the #mapping.
+     */
+    size_t mapping_size;
+    /**
+     * @brief Where the next fragment is written in the file.
+     */
+    off_t offset;
+    /**
+     * @brief The path of the checkpoint of the file, or NULL if it isn't
+     *        kept.
+     */
+    const char *checkpoint;
+    /**
+     * @brief How many bytes of the file the checkpoint says are on disk.
+     */
+    off_t checkpointed;
+    /**
+     * @brief The thread writing the file.
+     */
+    pthread_t thread;
+    /**
+     * @brief Protects the state of the ring.
+     */
+    pthread_mutex_t lock;
+    /**
+     * @brief Signalled when a fragment is added, or the writer is stopped.
+     */
+    pthread_cond_t not_empty;
+    /**
+     * @brief Signalled when fragments are written.
+     */
+    pthread_cond_t not_full;
+    /**
+     * @brief The ring of fragments.
+     */
+    uint8_t fragments[WRITE_BEHIND][PACKET_DATA_SIZE];
+    /**
+     * @brief The size of each fragment.
+     */
+    size_t sizes[WRITE_BEHIND];
+    /**
+     * @brief The index of the oldest fragment that wasn't written yet.
+     */
+    size_t head;
+    /**
+     * @brief The number of fragments that weren't written yet.
+     */
+    size_t count;
+    /**
+     * @brief Whether the thread should write what's left and stop.
+     */
+    bool stop;
+    /**
+     * @brief Whether writing to the file failed.
+     */
+    bool failed;
+} FileWriter;
+
+/**
+ * @brief Starts writing a file in the background.
+ *
+ * @param fd The file descriptor of the file.
+ * @param offset Where in the file to start writing.
+ * @param file_size The expected size of the file, to preallocate it.
+ * @param checkpoint The path of the checkpoint of the file, which must
+ *                   outlive the writer, or NULL to not keep one.
+ *
+ * @return The newly created writer.
+ * @return NULL on error.
+ */
+FileWriter *writer_create(int fd, off_t offset, size_t file_size,
+                          const char *checkpoint);
+
+/**
+ * @brief Queues a fragment to be written to the end of a file.
+ *
+ * @note Only blocks if too many fragments are waiting to be written.
+ *
+ * @param writer The writer.
+ * @param buf The fragment.
+ * @param size The size of the fragment, at most #PACKET_DATA_SIZE.
+ *
+ * @return The size of the fragment.
+ * @return -1 if writing to the file already failed.
+ */
+ssize_t writer_write(FileWriter *writer, const uint8_t *buf, size_t size);
+
+/**
+ * @brief Writes every fragment left, updates the checkpoint and deallocates
+ *        a writer.
+ *
+ * @note Doesn't close the file.
+ *
+ * @param writer The writer.
+ *
+ * @return -1 if writing to the file failed.
+ */
+int writer_destroy(FileWriter *writer);
+
+#endif // _WRITER_H_
@@ -4,8 +4,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+/**
+ * @brief How many bytes a vector can hold without allocating its #array.
+ */
+#define BV_INLINE_CAPACITY 16
+
 /**
  * @brief A struct representing a vector of bytes.
+ *
+ * @note Small vectors store their bytes inside the struct itself, so a vector
+ *       must never be copied by value.
  */
 typedef struct {
     /**
@@ -24,6 +32,10 @@ typedef struct {
      * The size of the #array.
      */
     size_t capacity;
+    /**
+     * @brief The storage used as the #array while the vector fits in it.
+     */
+    uint8_t inline_array[BV_INLINE_CAPACITY];
 } ByteVector;
 
 /**
@@ -39,6 +51,43 @@ ByteVector *bv_create();
  */
 void bv_destroy(ByteVector *vector);
 
+/**
+ * @brief Empties a vector, keeping its capacity so it can be reused.
+ *
+ * @param vector The vector to empty.
+ */
+void bv_clear(ByteVector *vector);
+
+/**
+ * @brief Makes sure a vector can hold at least a given number of bytes
+ *        without being resized.
+ *
+ * @param vector The vector.
+ * @param capacity The minimum capacity.
+ */
+void bv_reserve(ByteVector *vector, size_t capacity);
+
+/**
+ * @brief Makes room for some bytes at the end of a vector, so they can be
+ *        written in place.
+ *
+ * @note The bytes only become part of the vector after #bv_commit.
+ *
+ * @param vector The vector.
+ * @param len The number of bytes to make room for.
+ *
+ * @return Where to write the bytes.
+ */
+uint8_t *bv_spare(ByteVector *vector, size_t len);
+/**
+ * @brief Appends bytes written in place after #bv_spare to a vector.
+ *
+ * @param vector The vector.
+ * @param len The number of bytes that were written, at most the number
+ *            passed to #bv_spare.
+ */
+void bv_commit(ByteVector *vector, size_t len);
+
 /**
  * @brief Pushes an array of bytes to end of a vector.
  *
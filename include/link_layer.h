@@ -2,6 +2,8 @@
 #define _LINK_LAYER_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 
@@ -18,25 +20,198 @@
 #define C 9600
 #endif
 #define JOIN(a, b) a##b
-#define BAUDRATE(c) JOIN(B, c)
 #ifndef N_TRIES
 #define N_TRIES 3
 #endif
 #ifndef TIMEOUT
 #define TIMEOUT 4
 #endif
+#ifndef RTO_MIN
+#define RTO_MIN 200
+#endif
+#ifndef RTO_MAX
+#define RTO_MAX 60000
+#endif
+#ifndef RTO_BACKOFF
+#define RTO_BACKOFF 4
+#endif
+#ifndef WINDOW_SIZE
+#define WINDOW_SIZE 7
+#endif
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE 16384
+#endif
+#define ARQ_MODE(m) JOIN(LL_, m)
+#ifndef ARQ
+#define ARQ GO_BACK_N
+#endif
+#define FCS_MODE(m) JOIN(LL_, m)
+#ifndef FCS
+#define FCS CRC32
+#endif
+#ifndef FER_GAIN
+#define FER_GAIN 0.0625
+#endif
+#ifndef STATS
+#define STATS LL_STATS_NONE
+#endif
+
+/**
+ * @brief The number of bits used by sequence numbers.
+ *
+ * Sequence numbers are stored in the high nibble of the command byte.
+ */
+#define SEQ_BITS 4
+/**
+ * @brief The modulo of sequence numbers.
+ */
+#define SEQ_MODULO (1 << SEQ_BITS)
+
+#if WINDOW_SIZE < 1 || WINDOW_SIZE >= SEQ_MODULO
+#error "WINDOW_SIZE must be between 1 and SEQ_MODULO - 1"
+#endif
 
 /**
  * @brief An enum representing the role of a connection.
  */
 typedef enum _LLRole LLRole;
 
+/**
+ * @brief An enum representing the retransmission strategy of a connection.
+ */
+typedef enum _LLArqMode LLArqMode;
+
 /**
  * @brief A struct representing a connection and its state.
  */
 typedef struct _LLConnection LLConnection;
 
+/**
+ * @brief An enum representing how connection statistics are printed when a
+ *        connection is closed.
+ */
+typedef enum {
+    /**
+     * @brief They aren't printed.
+     */
+    LL_STATS_NONE = 0,
+    /**
+     * @brief They are printed as text, one per line.
+     */
+    LL_STATS_TEXT = 1,
+    /**
+     * @brief They are printed as a JSON object.
+     */
+    LL_STATS_JSON = 2,
+} LLStatsFormat;
+
+/**
+ * @brief A struct representing the statistics of a connection, see
+ *        #llstats.
+ */
+typedef struct {
+    /**
+     * @brief The number of I frames sent, without retransmissions.
+     */
+    uint64_t i_frames_sent;
+    /**
+     * @brief The number of I frames received intact, without duplicates.
+     */
+    uint64_t i_frames_received;
+    /**
+     * @brief The number of frames retransmitted, after a timeout or a #REJ
+     *        or #SREJ.
+     */
+    uint64_t retransmissions;
+    /**
+     * @brief The number of times the retransmission timer expired.
+     */
+    uint64_t timeouts;
+    /**
+     * @brief The number of #REJ frames sent.
+     */
+    uint64_t rej_sent;
+    /**
+     * @brief The number of #REJ frames received.
+     */
+    uint64_t rej_received;
+    /**
+     * @brief The number of #SREJ frames sent.
+     */
+    uint64_t srej_sent;
+    /**
+     * @brief The number of #SREJ frames received.
+     */
+    uint64_t srej_received;
+    /**
+     * @brief The number of I frames received more than once.
+     */
+    uint64_t duplicates;
+    /**
+     * @brief The number of I frames received damaged.
+     */
+    uint64_t damaged;
+    /**
+     * @brief The number of #PARITY frames sent.
+     */
+    uint64_t parity_sent;
+    /**
+     * @brief The number of I frames rebuilt from #PARITY frames, instead of
+     *        being retransmitted.
+     */
+    uint64_t recovered;
+    /**
+     * @brief The number of frames allocated, instead of reused from the
+     *        #FramePool, which stops growing once the transfer is steady.
+     */
+    uint64_t frame_allocations;
+    /**
+     * @brief The number of information vectors allocated, instead of reused
+     *        from the #FramePool.
+     */
+    uint64_t vector_allocations;
+    /**
+     * @brief The number of bytes of information sent, without
+     *        retransmissions.
+     */
+    uint64_t payload_bytes_sent;
+    /**
+     * @brief The number of bytes written to the serial port.
+     */
+    uint64_t wire_bytes_sent;
+    /**
+     * @brief The number of bytes of information received intact, without
+     *        duplicates.
+     */
+    uint64_t payload_bytes_received;
+    /**
+     * @brief The number of bytes read from the serial port.
+     */
+    uint64_t wire_bytes_received;
+    /**
+     * @brief How long #llopen took, in nanoseconds.
+     *
+     * The receiver's handshake ends when it receives the #SET, which is
+     * counted in the transfer instead.
+     */
+    uint64_t handshake_ns;
+    /**
+     * @brief How long the connection was open, in nanoseconds, from the end
+     *        of the handshake to the start of the teardown, or to now.
+     */
+    uint64_t transfer_ns;
+    /**
+     * @brief How long the teardown took so far, in nanoseconds, from the
+     *        first #DISC sent or received.
+     */
+    uint64_t teardown_ns;
+} LLStats;
+
+#include "link_layer/fcs.h"
+#include "link_layer/fec.h"
 #include "link_layer/frame.h"
+#include "link_layer/parser.h"
+#include "link_layer/pool.h"
 
 /**
  * @brief An enum representing the role of a connection.
@@ -52,6 +227,22 @@ enum _LLRole {
     LL_RX,
 };
 
+/**
+ * @brief An enum representing the retransmission strategy of a connection.
+ */
+enum _LLArqMode {
+    /**
+     * @brief Errors and timeouts retransmit every frame from the first one
+     *        that was lost, out of order frames are discarded.
+     */
+    LL_GO_BACK_N,
+    /**
+     * @brief Only the frames that were lost are retransmitted, out of order
+     *        frames are kept until they can be delivered.
+     */
+    LL_SELECTIVE_REPEAT,
+};
+
 /**
  * @brief A struct representing a connection and its state.
  */
@@ -65,6 +256,43 @@ struct _LLConnection {
      * @brief The serial port config present before the connection was setup.
      */
     struct termios old_termios;
+    /**
+     * @brief The baudrate of the serial port.
+     *
+     * #C, unless overridden by the C environment variable.
+     */
+    unsigned int baudrate;
+    /**
+     * @brief The ratio of received frames that are deliberately discarded as
+     *        damaged, to simulate a noisy line.
+     *
+     * #FER, unless overridden by the FER environment variable.
+     */
+    double fer;
+    /**
+     * @brief How long to wait after reading each frame, in microseconds, to
+     *        simulate propagation delay.
+     *
+     * #T_PROP, unless overridden by the T_PROP environment variable.
+     */
+    unsigned int t_prop;
+
+    /**
+     * @brief The statistics of this connection, without the durations.
+     */
+    LLStats stats;
+    /**
+     * @brief When #llopen was called.
+     */
+    struct timespec opened_at;
+    /**
+     * @brief When the handshake ended.
+     */
+    struct timespec established_at;
+    /**
+     * @brief When the first #DISC was sent or received, or 0 before then.
+     */
+    struct timespec closing_at;
 
     /**
      * @brief The file descriptor of the serial port used in this connection.
@@ -76,24 +304,182 @@ struct _LLConnection {
      * @brief Whether this connection has been closed.
      */
     bool closed;
+    /**
+     * @brief Whether the other side stopped answering within #N_TRIES
+     *        retransmissions, so frames are no longer retransmitted.
+     */
+    bool failed;
+    /**
+     * @brief How long to wait for frames to arrive before giving up, in
+     *        milliseconds, or -1 to wait forever, see #llset_read_timeout.
+     */
+    int read_timeout;
+
+    /**
+     * @brief Where bytes are read from the serial port into.
+     *
+     * Filled with as many bytes as are available on each read, so that frames
+     * aren't read one byte per syscall.
+     */
+    uint8_t rx_buffer[RX_BUFFER_SIZE];
+    /**
+     * @brief The parser of the bytes read, keeps partial frames between reads.
+     */
+    FrameParser parser;
+
+    /**
+     * @brief The frames and vectors that can be reused by this connection.
+     */
+    FramePool pool;
+    /**
+     * @brief The encoded frames without information, indexed by their
+     *        command.
+     */
+    uint8_t control_frames[256][CONTROL_FRAME_SIZE];
 
+    /**
+     * @brief The retransmission strategy of this connection.
+     */
+    LLArqMode arq;
+    /**
+     * @brief The frame check sequence of I frames.
+     *
+     * Starts as the strongest one this side supports, and is lowered to the
+     * one agreed on during the handshake.
+     */
+    LLFcsMode fcs;
+    /**
+     * @brief The maximum number of I frames that can be awaiting
+     *        acknowledgement at the same time.
+     *
+     * @note Is at most half of #SEQ_MODULO in selective repeat mode.
+     */
+    uint8_t window_size;
     /**
      * @brief The next sequence number to be used when sending an I frame.
      */
     uint8_t tx_sequence_nr;
+    /**
+     * @brief The sequence number of the oldest unacknowledged I frame.
+     *
+     * The window is empty when this is equal to #tx_sequence_nr.
+     */
+    uint8_t tx_base;
+    /**
+     * @brief The I frames sent and not yet acknowledged, indexed by their
+     *        sequence number.
+     */
+    Frame *tx_window[SEQ_MODULO];
     /**
      * @brief The next sequence number to be expected when receiving an I frame.
+     *
+     * Every frame before this one has been received.
      */
     uint8_t rx_sequence_nr;
+    /**
+     * @brief The sequence number of the next I frame to be returned by
+     *        #llread_into.
+     */
+    uint8_t rx_read_nr;
+    /**
+     * @brief The information of I frames received and not yet read, indexed
+     *        by their sequence number.
+     *
+     * In selective repeat mode, also holds frames received out of order.
+     */
+    ByteVector *rx_window[SEQ_MODULO];
+    /**
+     * @brief The caller's buffer of a pending #llread_into, which the
+     *        information of the I frame it waits for is destuffed straight
+     *        into, or NULL #ByteVector::array if there is none.
+     *
+     * Stored in #rx_window like any other information, but never pooled or
+     * freed.
+     */
+    ByteVector rx_target;
+    /**
+     * @brief Whether a #REJ was already sent for #rx_sequence_nr.
+     */
+    bool rej_sent;
+    /**
+     * @brief Whether a #SREJ was already sent for each sequence number.
+     */
+    bool srej_sent[SEQ_MODULO];
+    /**
+     * @brief When the last #SREJ was sent for each sequence number, so that
+     *        it's sent again if the frame doesn't arrive within #rto.
+     */
+    struct timespec srej_sent_at[SEQ_MODULO];
+
+    /**
+     * @brief How many I frames each #PARITY frame protects, 0 if none are
+     *        sent or expected.
+     *
+     * #FEC, unless overridden by the FEC environment variable.
+     */
+    unsigned int fec;
+    /**
+     * @brief How many groups of I frames are protected at the same time.
+     *
+     * #FEC_INTERLEAVE, unless overridden by the FEC_INTERLEAVE environment
+     * variable.
+     */
+    unsigned int fec_interleave;
+    /**
+     * @brief The groups of I frames sent whose #PARITY frames weren't sent
+     *        yet.
+     */
+    FecGroup fec_groups[SEQ_MODULO];
+    /**
+     * @brief The group the next I frame sent is added to.
+     */
+    unsigned int fec_next;
+    /**
+     * @brief A copy of the information of the last I frame received with each
+     *        sequence number, to rebuild the others of its group.
+     */
+    ByteVector *rx_copies[SEQ_MODULO];
 
     /**
      * @brief The number of retransmissions already sent.
      */
     int n_retransmissions_sent;
     /**
-     * @brief The POSIX timer used to resend frames on an interval.
+     * @brief When the count of retransmissions was last reset.
+     */
+    struct timespec tries_since;
+    /**
+     * @brief The smoothed round trip time of frames, in milliseconds.
+     *
+     * Is 0 until the first frame is acknowledged.
+     */
+    double srtt;
+    /**
+     * @brief The smoothed deviation of the round trip time of frames, in
+     *        milliseconds.
+     */
+    double rttvar;
+    /**
+     * @brief The retransmission timeout, in milliseconds.
+     *
+     * Starts as #TIMEOUT seconds, then follows the measured round trip times,
+     * between #RTO_MIN and #RTO_MAX, doubling on every timeout up to
+     * #RTO_BACKOFF times that, but no further than #TIMEOUT seconds, until
+     * frames are acknowledged again.
+     */
+    unsigned int rto;
+    /**
+     * @brief An estimate of the ratio of I frames sent that are lost or
+     *        damaged.
+     *
+     * A moving average, with weight #FER_GAIN, of the errors signalled by
+     * #REJ, #SREJ and timeouts per I frame sent.
+     */
+    double fer_estimate;
+    /**
+     * @brief The timerfd used to resend frames after a timeout.
      */
-    timer_t timer;
+    int timer;
     /**
      * @brief The last command frame sent by this connection.
      */
@@ -110,9 +496,34 @@ struct _LLConnection {
  */
 LLConnection *llopen(const char *serial_port, LLRole role);
 
+/**
+ * @brief Send data gathered from several buffers through a connection, as a
+ *        single I frame.
+ *
+ * @note Returns as soon as the frame is sent, only blocking while the
+ *       transmission window is full. Responses that already arrived are
+ *       handled first.
+ *
+ * @note The data is byte stuffed straight from the buffers, which don't need
+ *       to outlive the call.
+ *
+ * @param connection The connection to send data through.
+ * @param iov The buffers of the data to send.
+ * @param iovcnt The number of buffers.
+ *
+ * @return The number of bytes written.
+ * @return Negative on error, with errno set to ECONNRESET if the receiver
+ *         disconnected, see #lldisconnect, or ETIMEDOUT if it stopped
+ *         answering.
+ */
+ssize_t llwritev(LLConnection *connection, const struct iovec *iov,
+                 int iovcnt);
+
 /**
  * @brief Send data through a connection.
  *
+ * @note Equivalent to #llwritev with a single buffer.
+ *
  * @param connection The connection to send data through.
  * @param buf The data to send.
  * @param buf_len The length of the data.
@@ -122,26 +533,97 @@ LLConnection *llopen(const char *serial_port, LLRole role);
  */
 ssize_t llwrite(LLConnection *connection, const uint8_t *buf, size_t buf_len);
 
+/**
+ * @brief Counts the I frames sent through a connection that weren't
+ *        acknowledged yet.
+ *
+ * @param connection The connection.
+ *
+ * @return The number of frames.
+ */
+int llpending(LLConnection *connection);
+
+/**
+ * @brief Waits for the I frames sent through a connection to be acknowledged.
+ *
+ * @param connection The connection.
+ * @param max_pending How many frames can still be awaiting acknowledgement.
+ *
+ * @return -1 on error, with errno set to ECONNRESET if the receiver
+ *         disconnected, see #lldisconnect, or ETIMEDOUT if it stopped
+ *         answering.
+ */
+int llsync(LLConnection *connection, unsigned int max_pending);
+
 /**
  * @brief Receive data from a connection.
  *
+ * @note If the data didn't arrive yet, it's destuffed straight into buf as
+ *       it does, otherwise it's copied there.
+ *
  * @param connection The connection to receive data from.
  * @param buf Where to store the data.
+ * @param buf_size The size of buf.
  *
  * @return The number of bytes read.
- * @return Negative on error.
+ * @return Negative on error, or if the data doesn't fit in buf, in which case
+ *         it's dropped.
+ */
+ssize_t llread_into(LLConnection *connection, uint8_t *buf, size_t buf_size);
+
+/**
+ * @brief Estimates how many of the frames sent through a connection are lost
+ *        or damaged, see #LLConnection::fer_estimate.
+ *
+ * @param connection The connection.
+ *
+ * @return The estimated frame error ratio, between 0 and 1.
+ */
+double llerror_rate(LLConnection *connection);
+
+/**
+ * @brief Reads the statistics of a connection.
+ *
+ * @param connection The connection.
+ *
+ * @return The statistics, with durations up to now.
+ */
+LLStats llstats(LLConnection *connection);
+
+/**
+ * @brief Sets how long reads through a connection wait for the other side
+ *        before failing with ETIMEDOUT, so that a silent line can be given
+ *        up on.
+ *
+ * @param connection The connection.
+ * @param timeout The timeout, in milliseconds, or -1 to wait forever, the
+ *                default.
+ */
+void llset_read_timeout(LLConnection *connection, int timeout);
+
+/**
+ * @brief Disconnects from the transmitter before it's done, which makes its
+ *        next #llwritev fail with ECONNRESET.
+ *
+ * @note Only for the receiver, the connection must still be closed with
+ *       #llclose.
+ *
+ * @param connection The connection.
+ *
+ * @return -1 on error.
  */
-ssize_t llread(LLConnection *connection, uint8_t *buf);
+int lldisconnect(LLConnection *connection);
 
 /**
  * @brief Closes a previously opened connection.
  *
  * @param connection The connection to be closed.
- * @param show_stats Whether to print connection statistics.
+ * @param show_stats Whether and how to print connection statistics, to
+ *                   stdout, once the connection is closed.
  *
  * @return 1 on success.
  * @return Negative on error
  */
-int llclose(LLConnection *connection);
+int llclose(LLConnection *connection, LLStatsFormat show_stats);
 
 #endif // _LINK_LAYER_H_
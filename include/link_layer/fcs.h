@@ -0,0 +1,104 @@
+#ifndef _LINK_LAYER_FCS_H_
+#define _LINK_LAYER_FCS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief The largest number of bytes of a frame check sequence.
+ */
+#define FCS_MAX_SIZE 4
+
+/**
+ * @brief An enum representing the frame check sequence appended to the
+ *        information of I frames.
+ *
+ * The values are sent in the #SET and #UA of the handshake, so they must not
+ * change. A stronger check has a higher value.
+ */
+typedef enum {
+    /**
+     * @brief A single byte XOR of the information.
+     */
+    LL_BCC = 0,
+    /**
+     * @brief A 2 byte CRC-16-CCITT, as used by HDLC.
+     */
+    LL_CRC16 = 1,
+    /**
+     * @brief A 4 byte CRC-32, as used by Ethernet.
+     */
+    LL_CRC32 = 2,
+} LLFcsMode;
+
+/**
+ * @brief A struct representing a frame check sequence being computed.
+ */
+typedef struct {
+    /**
+     * @brief Which check is being computed.
+     */
+    LLFcsMode mode;
+    /**
+     * @brief The current value of the check.
+     */
+    uint32_t value;
+} Fcs;
+
+/**
+ * @brief Starts computing a frame check sequence.
+ *
+ * @param fcs The frame check sequence.
+ * @param mode Which check to compute.
+ */
+void fcs_init(Fcs *fcs, LLFcsMode mode);
+
+/**
+ * @brief Updates a frame check sequence with some bytes.
+ *
+ * @note CRCs use slicing-by-8 tables, and CRC-32 uses PCLMULQDQ on large
+ *       buffers if the CPU supports it.
+ *
+ * @param fcs The frame check sequence.
+ * @param buf The bytes.
+ * @param len The number of bytes.
+ */
+void fcs_update(Fcs *fcs, const uint8_t *buf, size_t len);
+
+/**
+ * @param mode The check.
+ *
+ * @return The number of bytes of a frame check sequence.
+ */
+size_t fcs_size(LLFcsMode mode);
+
+/**
+ * @brief Finishes computing a frame check sequence.
+ *
+ * @param fcs The frame check sequence.
+ * @param dst Where to write the bytes to append to the information, must fit
+ *            #fcs_size bytes.
+ *
+ * @return The number of bytes written to dst.
+ */
+size_t fcs_final(const Fcs *fcs, uint8_t *dst);
+
+/**
+ * @brief Checks a frame check sequence that was updated with the information
+ *        and the bytes appended to it by #fcs_final.
+ *
+ * @param fcs The frame check sequence.
+ *
+ * @return Whether the information is intact.
+ */
+bool fcs_check(const Fcs *fcs);
+
+/**
+ * @param mode The check.
+ *
+ * @return The name of the check.
+ */
+const char *fcs_name(LLFcsMode mode);
+
+#endif // _LINK_LAYER_FCS_H_
@@ -0,0 +1,135 @@
+#ifndef _LINK_LAYER_FEC_H_
+#define _LINK_LAYER_FEC_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "byte_vector.h"
+
+/**
+ * @brief How many I frames each #PARITY frame protects, 0 to send none.
+ *
+ * The code rate is FEC / (FEC + 1).
+ */
+#ifndef FEC
+#define FEC 0
+#endif
+/**
+ * @brief How many groups of I frames are protected at the same time, each
+ *        getting every FEC_INTERLEAVE-th frame sent.
+ */
+#ifndef FEC_INTERLEAVE
+#define FEC_INTERLEAVE 1
+#endif
+
+/**
+ * @brief The size of the header of the information of #PARITY frames: the
+ *        number of frames protected and the distance between their sequence
+ *        numbers.
+ */
+#define FEC_HEADER_SIZE 2
+/**
+ * @brief The size of the length of each frame XORed into a parity.
+ */
+#define FEC_LENGTH_SIZE 2
+
+/**
+ * @brief A struct representing a group of I frames being protected by a
+ *        #PARITY frame.
+ */
+typedef struct {
+    /**
+     * @brief The XOR of the length, as 2 little endian bytes, followed by the
+     *        information, of every frame in the group, padded with zeros to
+     *        the longest.
+     */
+    ByteVector *parity;
+    /**
+     * @brief The sequence number of the first frame in the group.
+     */
+    uint8_t first;
+    /**
+     * @brief The number of frames in the group.
+     */
+    uint8_t count;
+} FecGroup;
+
+#include "link_layer.h"
+#include "link_layer/frame.h"
+
+/**
+ * @brief Validates the FEC parameters of a connection against its
+ *        retransmission strategy and window, disabling or shrinking them if
+ *        needed.
+ *
+ * @param connection The connection.
+ */
+void fec_setup(LLConnection *connection);
+
+/**
+ * @brief XORs the length and information of a frame into a parity.
+ *
+ * @param parity The parity, grown with zeros to fit the information.
+ * @param iov The buffers of the information.
+ * @param iovcnt The number of buffers.
+ */
+void fec_add(ByteVector *parity, const struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Adds an I frame that was just sent to the next group, sending the
+ *        group's #PARITY frame if it's now full.
+ *
+ * @param connection The connection.
+ * @param s The sequence number of the frame.
+ * @param iov The buffers of the frame's information.
+ * @param iovcnt The number of buffers.
+ *
+ * @return -1 on error.
+ */
+int fec_sent(LLConnection *connection, uint8_t s, const struct iovec *iov,
+             int iovcnt);
+
+/**
+ * @brief Sends the #PARITY frames of every group that isn't full yet, so the
+ *        receiver doesn't wait for them.
+ *
+ * @param connection The connection.
+ *
+ * @return -1 on error.
+ */
+int fec_flush(LLConnection *connection);
+
+/**
+ * @brief Keeps a copy of the information of an I frame received, to rebuild
+ *        other frames of its group.
+ *
+ * @param connection The connection.
+ * @param s The sequence number of the frame.
+ * @param information The information.
+ */
+void fec_keep(LLConnection *connection, uint8_t s,
+              const ByteVector *information);
+
+/**
+ * @brief Extracts the information of the only frame of a group whose
+ *        information wasn't XORed into a parity, see #fec_add.
+ *
+ * @param parity The parity, turned into the information of the frame.
+ *
+ * @return The length of the information.
+ * @return -1 if the parity isn't consistent with a single frame missing.
+ */
+ssize_t fec_recover(ByteVector *parity);
+
+/**
+ * @brief Computes how many sequence numbers a group of I frames of a
+ *        connection spans, from its first frame to its last.
+ *
+ * @param connection The connection.
+ *
+ * @return The span, or 0 if no #PARITY frames are sent.
+ */
+uint8_t fec_span(LLConnection *connection);
+
+#endif // _LINK_LAYER_FEC_H_
@@ -6,10 +6,23 @@
  */
 typedef struct _Frame Frame;
 
+/**
+ * @brief A struct representing a pool of frames, see pool.h.
+ */
+typedef struct _FramePool FramePool;
+
+/**
+ * @brief The size of a frame without information.
+ */
+#define CONTROL_FRAME_SIZE 5
+
 #include "byte_vector.h"
 #include "link_layer.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
 
 /**
  * @brief Sets the n-th bit to b.
@@ -33,6 +46,19 @@ typedef struct _Frame Frame;
  */
 #define TX_ADDR (uint8_t)0x07
 
+/**
+ * @brief The sequence number that comes after s.
+ */
+#define SEQ_NEXT(s) (uint8_t)(((s) + 1) % SEQ_MODULO)
+/**
+ * @brief The sequence number that comes before s.
+ */
+#define SEQ_PREV(s) (uint8_t)(((s) + SEQ_MODULO - 1) % SEQ_MODULO)
+/**
+ * @brief How many sequence numbers must be advanced to get from a to b.
+ */
+#define SEQ_DISTANCE(a, b) (uint8_t)(((b) - (a) + SEQ_MODULO) % SEQ_MODULO)
+
 /**
  * @brief A set-up command.
  */
@@ -46,11 +72,24 @@ typedef struct _Frame Frame;
  *
  * Frames with this command have additional information.
  */
-#define I(s) (uint8_t)(BIT_B((s), 6) | 0b0000)
+#define I(s) (uint8_t)(BIT_B((s) % SEQ_MODULO, 4) | 0b0000)
+/**
+ * @brief A parity command, see fec.h.
+ *
+ * Frames with this command have the XOR of the information of a group of #I
+ * frames, the first of which has sequence number s, as additional
+ * information.
+ *
+ * @note The type bits were chosen so that neither the command nor the
+ *       header's BCC can ever be a #FLAG or an #ESC.
+ */
+#define PARITY(s) (uint8_t)(BIT_B((s) % SEQ_MODULO, 4) | 0b0110)
 /**
  * @brief Checks if a frame type is a command.
  */
-#define IS_COMMAND(c) ((c) == SET || (c) == DISC || ((c)&0xf) == I(0))
+#define IS_COMMAND(c)                                                          \
+    (((c)&0xf) == SET || (c) == DISC || ((c)&0xf) == I(0) ||                   \
+     ((c)&0xf) == PARITY(0))
 
 /**
  * @brief An unnumbered acknowledgement response.
@@ -63,17 +102,50 @@ typedef struct _Frame Frame;
  *
  * Used as a response to #I when no error was detected.
  */
-#define RR(r) (uint8_t)(BIT_B((r), 7) | 0b0101)
+#define RR(r) (uint8_t)(BIT_B((r) % SEQ_MODULO, 4) | 0b0101)
 /**
  * @brief A rejection response.
  *
  * Used as a response to #I when an error was detected.
  */
-#define REJ(r) (uint8_t)(BIT_B((r), 7) | 0b0001)
+#define REJ(r) (uint8_t)(BIT_B((r) % SEQ_MODULO, 4) | 0b0001)
+/**
+ * @brief A selective rejection response.
+ *
+ * Used as a response to #I in selective repeat mode, asks for the
+ * retransmission of a single frame.
+ *
+ * @note The type bits were chosen so that neither the command nor the
+ *       header's BCC can ever be a #FLAG or an #ESC.
+ */
+#define SREJ(r) (uint8_t)(BIT_B((r) % SEQ_MODULO, 4) | 0b1000)
 /**
  * @brief Checks if a frame type is a response.
  */
-#define IS_RESPONSE(c) ((c) == UA || ((c)&0xf) == RR(0) || ((c)&0xf) == REJ(0))
+#define IS_RESPONSE(c)                                                         \
+    (((c)&0xf) == UA || ((c)&0xf) == RR(0) || ((c)&0xf) == REJ(0) ||           \
+     ((c)&0xf) == SREJ(0))
+
+/**
+ * @brief Gets the type of a command, without its sequence number.
+ */
+#define FRAME_TYPE(c) (uint8_t)((c)&0xf)
+/**
+ * @brief Gets the sequence number of an #I, #PARITY, #RR, #REJ or #SREJ
+ *        command.
+ */
+#define SEQ_NR(c) (uint8_t)((c) >> 4)
+/**
+ * @brief Adds a frame check sequence to a #SET or #UA command.
+ *
+ * The #SET of the handshake proposes the strongest check the transmitter
+ * supports, and the #UA answers with the one the receiver agrees to.
+ */
+#define WITH_FCS(c, f) (uint8_t)(BIT_B(f, 4) | (c))
+/**
+ * @brief Gets the frame check sequence of a #SET or #UA command.
+ */
+#define FCS_NR(c) (LLFcsMode)((c) >> 4)
 
 /**
  * @brief An information error command.
@@ -114,16 +186,43 @@ struct _Frame {
     /**
      * @brief This frame's command.
      *
-     * Can be one of #UA, #SET, #DISC, #I, #RR, #REJ, or #I_ERR.
+     * Can be one of #UA, #SET, #DISC, #I, #PARITY, #RR, #REJ, #SREJ, or
+     * #I_ERR.
      */
     uint8_t command;
 
     /**
      * @brief Additional information sent with this frame.
      *
-     * Only sent on #I frames.
+     * Only sent on #I and #PARITY frames.
      */
     ByteVector *information;
+    /**
+     * @brief This frame as written to the serial port, kept so that it can be
+     *        retransmitted without being encoded again.
+     *
+     * Only used by #I frames, the others are encoded by #init_control_frames.
+     */
+    ByteVector *encoded;
+
+    /**
+     * @brief When this frame was first sent.
+     */
+    struct timespec sent_at;
+    /**
+     * @brief Whether this frame was sent more than once.
+     */
+    bool retransmitted;
+
+    /**
+     * @brief The next frame in a queue of frames.
+     */
+    Frame *next;
+
+    /**
+     * @brief The pool this frame returns to when destroyed, if any.
+     */
+    FramePool *pool;
 };
 
 /**
@@ -136,18 +235,77 @@ struct _Frame {
  */
 Frame *create_frame(LLConnection *connection, uint8_t cmd);
 
+/**
+ * @brief Constructs the BCC byte for a given frame.
+ *
+ * @param frame The frame.
+ *
+ * @return The BCC byte.
+ */
+uint8_t make_bcc(Frame *frame);
+
+/**
+ * @brief Checks if a frame's address and command combination can be handled by
+ *        this layer's role.
+ *
+ * @param frame The frame.
+ * @param role This layer's role
+ *
+ * @return Whether the frame's address and command combination is legal.
+ */
+bool check_command_and_address(Frame *frame, LLRole role);
+
+/**
+ * @brief Waits for the serial port of a connection to have bytes to read, or
+ *        for its retransmission timer to fire, and handles whichever did.
+ *
+ * This is the connection's event loop: bytes read are parsed, see
+ * #parse_frames, and timeouts retransmit frames, see #timer_expired, on the
+ * calling thread.
+ *
+ * @param connection The connection.
+ * @param timeout How long to wait, in milliseconds, -1 to wait indefinitely
+ *                and 0 to only handle what is already pending.
+ *
+ * @return -1 on error, or if the maximum number of retransmissions was
+ *         reached.
+ * @return 0 if the timeout expired with nothing to handle, 1 otherwise.
+ */
+int wait_events(LLConnection *connection, int timeout);
+
 /**
  * @brief Reads a frame from a connection.
  *
+ * @note Keeps retransmitting frames while waiting, see #wait_events.
+ *
  * @param connection The connection to read from.
  *
  * @return The frame that was read.
+ * @return NULL on error, with errno set to ETIMEDOUT if nothing arrived
+ *         within #LLConnection::read_timeout while no frame was awaiting
+ *         acknowledgement.
  */
 Frame *read_frame(LLConnection *connection);
 
+/**
+ * @brief Encodes an #I frame, with the given information, into its #encoded
+ *        vector.
+ *
+ * @param connection The connection the frame will be sent through.
+ * @param frame The frame.
+ * @param iov The buffers the information is gathered from, which don't need
+ *            to outlive this call.
+ * @param iovcnt The number of buffers.
+ */
+void encode_frame(LLConnection *connection, Frame *frame,
+                  const struct iovec *iov, int iovcnt);
+
 /**
  * @brief Writes a frame onto a connection.
  *
+ * @note #I frames are encoded into their #encoded vector, see #encode_frame,
+ *       the first time they are written, later writes reuse it.
+ *
  * @param connection The connection to write to.
  *
  * @return The number of bytes written.
@@ -155,9 +313,19 @@ Frame *read_frame(LLConnection *connection);
  */
 ssize_t write_frame(LLConnection *connection, Frame *frame);
 
+/**
+ * @brief Encodes every frame without information that a connection can send,
+ *        so they can be sent without being built each time.
+ *
+ * @param connection The connection.
+ */
+void init_control_frames(LLConnection *connection);
+
 /**
  * @brief Deallocates resources created by a frame.
  *
+ * @note Frames from a pool are returned to it instead.
+ *
  * @param this The frame to deallocate.
  */
 void frame_destroy(Frame *this);
@@ -176,6 +344,56 @@ void frame_destroy(Frame *this);
  */
 ssize_t send_frame(LLConnection *connection, Frame *frame);
 
+/**
+ * @brief Counts an I frame sent through a connection as lost or damaged, in
+ *        its #LLConnection::fer_estimate.
+ *
+ * @param connection The connection.
+ */
+void count_frame_error(LLConnection *connection);
+
+/**
+ * @brief Records that the teardown of a connection started now, unless it
+ *        already did, see #LLConnection::closing_at.
+ *
+ * @param connection The connection.
+ */
+void mark_closing(LLConnection *connection);
+
+/**
+ * @brief Sends a response through a connection.
+ *
+ * @note Writes the frame encoded by #init_control_frames, without creating
+ *       it.
+ *
+ * @param connection The connection to send through.
+ * @param command The command byte of the response.
+ *
+ * @return The number of bytes written.
+ * @return -1 on error.
+ */
+ssize_t send_response(LLConnection *connection, uint8_t command);
+
+/**
+ * @brief Reads a single frame from a connection and handles it.
+ *
+ * @param connection The connection to read from.
+ *
+ * @return The frame that was read.
+ * @return NULL on error.
+ */
+Frame *receive_frame(LLConnection *connection);
+
+/**
+ * @brief Handles every frame a connection already received, without
+ *        blocking.
+ *
+ * @param connection The connection.
+ *
+ * @return -1 on error.
+ */
+int poll_frames(LLConnection *connection);
+
 /**
  * @brief Reads frames continuously until a specified type is received.
  *
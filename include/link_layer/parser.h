@@ -0,0 +1,131 @@
+#ifndef _LINK_LAYER_PARSER_H_
+#define _LINK_LAYER_PARSER_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "byte_vector.h"
+#include "link_layer/fcs.h"
+
+/**
+ * @brief An enum representing the valid states in the state machine for reading
+ *        a frame.
+ */
+typedef enum {
+    /**
+     * @brief The starting state.
+     */
+    START,
+    /**
+     * @brief The state after the first #FLAG was read.
+     */
+    FLAG_RCV,
+    /**
+     * @brief The state after the address was read.
+     */
+    A_RCV,
+    /**
+     * @brief The state after the command was read.
+     */
+    C_RCV,
+    /**
+     * @brief The state after the bcc of a frame without information was read
+     *        and verified.
+     */
+    BCC_RCV,
+    /**
+     * @brief The state after some data in an I frame was read.
+     */
+    DATA_RCV,
+    /**
+     * @brief The state after an #ESC byte was read.
+     */
+    ESC_RCV,
+} ReadFrameState;
+
+/**
+ * @brief A struct representing the state of the frame parser of a connection.
+ */
+typedef struct {
+    /**
+     * @brief The current state of the state machine.
+     */
+    ReadFrameState state;
+    /**
+     * @brief The frame currently being parsed.
+     */
+    struct _Frame *frame;
+    /**
+     * @brief The frame check sequence of the information of the frame being
+     *        parsed.
+     */
+    Fcs fcs;
+    /**
+     * @brief The buffer of a pending read the information of the frame being
+     *        parsed is destuffed straight into, or NULL if it's destuffed
+     *        into the frame's own vector.
+     *
+     * Only the frame check sequence may go past its capacity, into
+     * #overflow, bigger frames are moved to a vector of their own.
+     */
+    ByteVector *target;
+    /**
+     * @brief Where the bytes that don't fit in #target go, one more than a
+     *        frame check sequence to detect that it doesn't fit.
+     */
+    uint8_t overflow[FCS_MAX_SIZE + 1];
+    /**
+     * @brief The oldest frame that was parsed and not yet taken.
+     *
+     * The rest of the parsed frames follow through their next pointers.
+     */
+    struct _Frame *first;
+    /**
+     * @brief The newest frame that was parsed and not yet taken.
+     */
+    struct _Frame *last;
+} FrameParser;
+
+#include "link_layer.h"
+#include "link_layer/frame.h"
+
+/**
+ * @brief Parses a chunk of bytes received by a connection.
+ *
+ * The chunk may end anywhere, the state of a partial frame is kept for the
+ * next call. Every frame that is completed is queued, see #parser_take.
+ *
+ * @param connection The connection the bytes were received by.
+ * @param buf The bytes.
+ * @param len The number of bytes.
+ */
+void parse_frames(LLConnection *connection, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Takes the oldest frame parsed by a connection.
+ *
+ * @param connection The connection.
+ *
+ * @return The frame.
+ * @return NULL if no frames were parsed.
+ */
+Frame *parser_take(LLConnection *connection);
+
+/**
+ * @brief Stops destuffing frames into the buffer of a pending read, see
+ *        #LLConnection::rx_target.
+ *
+ * A frame still being destuffed into it is dropped, to be retransmitted.
+ *
+ * @param connection The connection.
+ */
+void parser_release_target(LLConnection *connection);
+
+/**
+ * @brief Deallocates every frame held by a parser.
+ *
+ * @param parser The parser.
+ */
+void parser_destroy(FrameParser *parser);
+
+#endif // _LINK_LAYER_PARSER_H_
@@ -0,0 +1,89 @@
+#ifndef _LINK_LAYER_POOL_H_
+#define _LINK_LAYER_POOL_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "byte_vector.h"
+
+/**
+ * @brief The maximum number of unused vectors kept by a pool.
+ */
+#define POOL_VECTORS 40
+
+/**
+ * @brief A struct representing a pool of frames and vectors that can be
+ *        reused, so frames don't need to be allocated in the hot path.
+ */
+typedef struct _FramePool {
+    /**
+     * @brief The unused frames, linked through their next pointers.
+     */
+    struct _Frame *frames;
+    /**
+     * @brief The unused vectors, with their capacity preserved.
+     */
+    ByteVector *vectors[POOL_VECTORS];
+    /**
+     * @brief The number of unused vectors in #vectors.
+     */
+    size_t n_vectors;
+
+    /**
+     * @brief The number of frames allocated by this pool.
+     */
+    size_t frame_allocations;
+    /**
+     * @brief The number of vectors allocated by this pool.
+     */
+    size_t vector_allocations;
+} FramePool;
+
+#include "link_layer/frame.h"
+
+/**
+ * @brief Gets a frame from a pool, allocating it if there are none unused.
+ *
+ * @note The frame has no information, and returns to the pool when destroyed.
+ *
+ * @param pool The pool.
+ *
+ * @return The frame.
+ * @return NULL on error.
+ */
+Frame *pool_get_frame(FramePool *pool);
+/**
+ * @brief Returns a frame to a pool, along with its information.
+ *
+ * @param pool The pool.
+ * @param frame The frame.
+ */
+void pool_put_frame(FramePool *pool, Frame *frame);
+
+/**
+ * @brief Gets an empty vector from a pool, allocating it if there are none
+ *        unused.
+ *
+ * @param pool The pool.
+ *
+ * @return The vector.
+ */
+ByteVector *pool_get_vector(FramePool *pool);
+/**
+ * @brief Returns a vector to a pool.
+ *
+ * @note The vector is destroyed if the pool is full.
+ *
+ * @param pool The pool.
+ * @param vector The vector.
+ */
+void pool_put_vector(FramePool *pool, ByteVector *vector);
+
+/**
+ * @brief Deallocates every unused frame and vector in a pool.
+ *
+ * @param pool The pool.
+ */
+void pool_destroy(FramePool *pool);
+
+#endif // _LINK_LAYER_POOL_H_
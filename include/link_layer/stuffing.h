@@ -0,0 +1,67 @@
+#ifndef _LINK_LAYER_STUFFING_H_
+#define _LINK_LAYER_STUFFING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "link_layer/fcs.h"
+
+/**
+ * @brief An enum representing why #destuff_bytes stopped.
+ */
+typedef enum {
+    /**
+     * @brief Every byte was consumed, the frame continues in the next bytes.
+     */
+    DESTUFF_MORE,
+    /**
+     * @brief A #FLAG was found, the frame ended.
+     */
+    DESTUFF_FLAG,
+    /**
+     * @brief An #ESC was followed by a byte that can't be escaped.
+     */
+    DESTUFF_INVALID,
+} DestuffResult;
+
+/**
+ * @brief Byte stuffs a buffer, escaping every #FLAG and #ESC in it.
+ *
+ * @note Uses SSE2 or AVX2, if the CPU supports them, to copy the runs of
+ *       bytes that don't need to be escaped. The frame check sequence is
+ *       updated block by block, while the bytes are still cached.
+ *
+ * @param dst Where to write the stuffed bytes, must fit 2 * len bytes.
+ * @param src The bytes to stuff.
+ * @param len The number of bytes to stuff.
+ * @param fcs Updated with every byte in src, unless NULL.
+ *
+ * @return The number of bytes written to dst.
+ */
+size_t stuff_bytes(uint8_t *dst, const uint8_t *src, size_t len, Fcs *fcs);
+
+/**
+ * @brief Destuffs a buffer, until the end of it or the first #FLAG.
+ *
+ * @note Uses SSE2 or AVX2, if the CPU supports them, to copy the runs of
+ *       bytes that weren't escaped. The frame check sequence is updated block
+ *       by block, while the bytes are still cached.
+ *
+ * @param dst Where to write the destuffed bytes, must fit len bytes.
+ * @param src The bytes to destuff.
+ * @param len The number of bytes in src.
+ * @param consumed Where to store the number of bytes consumed from src,
+ *                 including the #FLAG, if one was found.
+ * @param produced Where to store the number of bytes written to dst.
+ * @param escaped Whether the byte before src was an #ESC, updated with whether
+ *                the last byte of src was one.
+ * @param fcs Updated with every byte written to dst, unless NULL.
+ *
+ * @return Why destuffing stopped.
+ */
+DestuffResult destuff_bytes(uint8_t *dst, const uint8_t *src, size_t len,
+                            size_t *consumed, size_t *produced, bool *escaped,
+                            Fcs *fcs);
+
+#endif // _LINK_LAYER_STUFFING_H_
@@ -6,6 +6,8 @@
 /**
  * @brief Sets up the timer for a given connection.
  *
+ * The timer is a timerfd, polled along with the serial port by #wait_events.
+ *
  * @param connection The connection.
  */
 int timer_setup(LLConnection *connection);
@@ -17,7 +19,8 @@ int timer_setup(LLConnection *connection);
 int timer_destroy(LLConnection *connection);
 
 /**
- * @brief Arms the timer for a given connection.
+ * @brief Arms the timer for a given connection, to fire after its current
+ *        retransmission timeout.
  *
  * @param connection The connection
  */
@@ -28,12 +31,64 @@ int timer_arm(LLConnection *connection);
  * @param connection The connection
  */
 int timer_disarm(LLConnection *connection);
+/**
+ * @brief Checks whether the timer for a given connection is armed, so that
+ *        a frame is awaiting acknowledgement.
+ *
+ * @param connection The connection
+ */
+bool timer_armed(LLConnection *connection);
 
 /**
- * @brief Forces the timer handler of a given connection to be run.
+ * @brief Retransmits the frames awaiting acknowledgement, or the last command
+ *        frame, of a given connection, doubles its retransmission timeout and
+ *        arms the timer again.
+ *
+ * Gets called by #wait_events when the timer fires.
  *
  * @param connection The connection
+ *
+ * @return -1 if the maximum number of retransmissions was reached.
+ */
+int timer_expired(LLConnection *connection);
+
+/**
+ * @brief Retransmits frames right away, like #timer_expired, without
+ *        doubling the retransmission timeout.
+ *
+ * @param connection The connection
+ *
+ * @return -1 if the maximum number of retransmissions was reached.
  */
 int timer_force(LLConnection *connection);
 
+/**
+ * @brief Resets the count of retransmissions towards #N_TRIES of a connection,
+ *        after a new frame is sent.
+ *
+ * @param connection The connection.
+ */
+void timer_reset_tries(LLConnection *connection);
+
+/**
+ * @brief Drops the backoff of the retransmission timeout of a connection,
+ *        and the count of retransmissions towards #N_TRIES, once the other
+ *        side shows that frames get through.
+ *
+ * @param connection The connection.
+ */
+void timer_progress(LLConnection *connection);
+
+/**
+ * @brief Updates the round trip time estimate and retransmission timeout of a
+ *        connection, after a frame was acknowledged.
+ *
+ * Uses Jacobson and Karels' algorithm, and ignores frames that were
+ * retransmitted, per Karn's rule, other than to drop the backoff.
+ *
+ * @param connection The connection.
+ * @param frame The frame that was acknowledged, may be NULL.
+ */
+void timer_measure(LLConnection *connection, Frame *frame);
+
 #endif // _LINK_LAYER_TIMER_H_
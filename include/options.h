@@ -0,0 +1,17 @@
+#ifndef _OPTIONS_H_
+#define _OPTIONS_H_
+
+/**
+ * @brief Reads a numeric option from the environment, so that parameters can
+ *        be changed without recompiling, such as in benchmarks.
+ *
+ * @note The compile time parameter of the same name is usually the default.
+ *
+ * @param name The name of the environment variable.
+ * @param default_value The value of the option if the variable isn't set.
+ *
+ * @return The value of the option.
+ */
+double option(const char *name, double default_value);
+
+#endif // _OPTIONS_H_
@@ -0,0 +1,257 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Whether events are traced, 0 or 1.
+ */
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+/**
+ * @brief How many of the latest events are kept for each thread, a power of
+ *        2.
+ */
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 16384
+#endif
+
+#if TRACE_RECORDS & (TRACE_RECORDS - 1)
+#error "TRACE_RECORDS must be a power of 2"
+#endif
+
+/**
+ * @brief The magic bytes a trace file starts with.
+ */
+#define TRACE_MAGIC "LLTRACE"
+
+/**
+ * @brief The version of the format of trace files.
+ */
+#define TRACE_VERSION 1
+
+/**
+ * @brief An enum representing the events that are traced.
+ *
+ * The values are stored in trace files, so they must not change.
+ */
+typedef enum {
+    /**
+     * @brief The connection changed phase, arg is a #TracePhase.
+     */
+    TRACE_PHASE = 0,
+    /**
+     * @brief A frame was written, arg is its command and value its size.
+     */
+    TRACE_FRAME_SENT = 1,
+    /**
+     * @brief A frame was written again, arg is its command and value its
+     *        size.
+     */
+    TRACE_FRAME_RESENT = 2,
+    /**
+     * @brief A frame was received, arg is its command and value the size of
+     *        its information.
+     */
+    TRACE_FRAME_RECEIVED = 3,
+    /**
+     * @brief Bytes were read from the serial port, value is how many.
+     */
+    TRACE_BYTES_READ = 4,
+    /**
+     * @brief The retransmission timer was armed, value is the timeout in
+     *        milliseconds.
+     */
+    TRACE_TIMER_ARMED = 5,
+    /**
+     * @brief The retransmission timer was disarmed.
+     */
+    TRACE_TIMER_DISARMED = 6,
+    /**
+     * @brief The retransmission timer expired, value is how many
+     *        retransmissions were already sent.
+     */
+    TRACE_TIMER_EXPIRED = 7,
+    /**
+     * @brief #llwritev was called, value is the size of the data.
+     */
+    TRACE_LLWRITE = 8,
+    /**
+     * @brief #llread_into returned, value is the size of the data.
+     */
+    TRACE_LLREAD = 9,
+    /**
+     * @brief A packet was received, arg is its type and value its size.
+     */
+    TRACE_PACKET_RECEIVED = 10,
+    /**
+     * @brief A file fragment was compressed, value is its compressed size, or
+     *        0 if it wasn't worth it.
+     */
+    TRACE_FRAGMENT_COMPRESSED = 11,
+    /**
+     * @brief Received file fragments were written, value is how many bytes.
+     */
+    TRACE_FILE_WRITTEN = 12,
+    /**
+     * @brief The number of events.
+     */
+    TRACE_EVENTS,
+} TraceEvent;
+
+/**
+ * @brief An enum representing the phases of a connection, see #TRACE_PHASE.
+ */
+typedef enum {
+    /**
+     * @brief #llopen was called.
+     */
+    TRACE_OPENING = 0,
+    /**
+     * @brief The handshake ended.
+     */
+    TRACE_ESTABLISHED = 1,
+    /**
+     * @brief The first #DISC was sent or received.
+     */
+    TRACE_CLOSING = 2,
+    /**
+     * @brief The connection was closed.
+     */
+    TRACE_CLOSED = 3,
+} TracePhase;
+
+/**
+ * @brief A struct representing a traced event.
+ */
+typedef struct {
+    /**
+     * @brief When the event happened, in nanoseconds of CLOCK_MONOTONIC.
+     */
+    uint64_t time;
+    /**
+     * @brief The #TraceEvent.
+     */
+    uint16_t event;
+    /**
+     * @brief A small argument, whose meaning depends on the event.
+     */
+    uint16_t arg;
+    /**
+     * @brief A value, whose meaning depends on the event.
+     */
+    uint32_t value;
+} TraceRecord;
+
+/**
+ * @brief A struct representing the events traced by a thread, which only it
+ *        writes to.
+ *
+ * Rings are never freed, so that the events of threads that already
+ * finished can still be dumped.
+ */
+typedef struct _TraceRing {
+    /**
+     * @brief The id of the thread.
+     */
+    uint32_t thread;
+    /**
+     * @brief How many events were ever traced, the newest one being at index
+     *        head - 1 modulo #TRACE_RECORDS.
+     */
+    uint64_t head;
+    /**
+     * @brief The latest events.
+     */
+    TraceRecord records[TRACE_RECORDS];
+    /**
+     * @brief The next ring in the list of every ring.
+     */
+    struct _TraceRing *next;
+} TraceRing;
+
+/**
+ * @brief The ring of the current thread, or NULL if it didn't trace anything
+ *        yet.
+ */
+extern __thread TraceRing *trace_ring;
+
+/**
+ * @brief Creates the ring of the current thread.
+ *
+ * The first ring created also makes the rings be dumped, on exit, to the file
+ * named by the TRACE_FILE environment variable, if set.
+ *
+ * @return The ring.
+ * @return NULL on error.
+ */
+TraceRing *trace_ring_create(void);
+
+/**
+ * @brief Records an event in the ring of the current thread, overwriting the
+ *        oldest one if it's full.
+ *
+ * @note Doesn't lock or allocate, except for the first event of a thread.
+ *
+ * @param event The event.
+ * @param arg Its argument.
+ * @param value Its value.
+ */
+static inline void trace_event(TraceEvent event, uint16_t arg,
+                               uint32_t value) {
+    TraceRing *ring = trace_ring;
+
+    if (ring == NULL && (ring = trace_ring_create()) == NULL)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    TraceRecord *record = &ring->records[ring->head & (TRACE_RECORDS - 1)];
+    record->time = now.tv_sec * 1000000000ull + now.tv_nsec;
+    record->event = event;
+    record->arg = arg;
+    record->value = value;
+
+    // The record is complete before a dump can see it
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Writes the events of every thread to a file.
+ *
+ * The file starts with #TRACE_MAGIC, #TRACE_VERSION and the size of a
+ * #TraceRecord, followed by, for each thread, its id, its number of records,
+ * and its records, oldest first. Every number is in native byte order.
+ *
+ * @note Threads that are still tracing may overwrite their oldest records
+ *       while they're written.
+ *
+ * @param path The path of the file.
+ *
+ * @return -1 on error.
+ */
+int trace_dump(const char *path);
+
+/**
+ * @brief Returns the name of an event.
+ *
+ * @param event The event.
+ *
+ * @return The name, or NULL if the event is unknown.
+ */
+const char *trace_event_name(uint16_t event);
+
+#if TRACE
+/**
+ * @brief Traces an event, if #TRACE is set, see #trace_event.
+ */
+#define TRACE_EVENT(event, arg, value) trace_event(event, arg, value)
+#else
+#define TRACE_EVENT(event, arg, value)
+#endif
+
+#endif // _TRACE_H_
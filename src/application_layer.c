@@ -2,10 +2,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -14,27 +16,32 @@
 #include "byte_vector.h"
 #include "link_layer.h"
 #include "log.h"
+#include "options.h"
+#include "trace.h"
 
 #include "application_layer.h"
+#include "application_layer/channel.h"
+#include "application_layer/checkpoint.h"
 #include "application_layer/packet.h"
+#include "application_layer/reader.h"
+#include "application_layer/writer.h"
 
 /**
- * @brief Opens a connection to the receiver through the given serial port.
+ * @brief Opens a connection to the receiver through the given serial ports,
+ *        bonded if there's more than one, see #bond_open.
  *
- * @param serial_port The serial port to connect to.
+ * @param serial_ports The serial ports to connect to.
  * @param role The role of this application instance.
  *
- * @return A pointer to the connection object created.
+ * @return A pointer to the bond created.
  * @return NULL on failure.
  */
-LLConnection *connect(const char *serial_port, LLRole role) {
-    LOG("Connecting to %s\n", serial_port);
+Bond *connect(const char *serial_ports, LLRole role) {
+    Bond *bond = bond_open(serial_ports, role);
 
-    LLConnection *connection = llopen(serial_port, role);
-
-    if (connection == NULL) {
+    if (bond == NULL) {
         ERROR("Serial connection on port %s not available, aborting\n",
-              serial_port);
+              serial_ports);
         exit(-1);
     }
 
@@ -42,31 +49,57 @@ LLConnection *connect(const char *serial_port, LLRole role) {
         LOG("Connection established\n");
     }
 
-    return connection;
+    return bond;
 }
 
 /**
- * @brief Starts the transmission process.
+ * @brief Reads the largest size of file fragments to send, which can be
+ *        lowered at runtime with the PACKET_SIZE environment variable.
  *
- * @param connection The connection through which the transmission is being
- *                   done.
- * @param filename The name of the file to transmit.
+ * @return The size, between 1 and #PACKET_DATA_SIZE.
+ */
+size_t max_fragment_size(void) {
+    double size = option("PACKET_SIZE", PACKET_DATA_SIZE);
+
+    // Fragments are read into slots of PACKET_DATA_SIZE bytes
+    if (size < 1 || size > PACKET_DATA_SIZE) {
+        ALARM("PACKET_SIZE must be between 1 and %d, using %d\n",
+              PACKET_DATA_SIZE, PACKET_DATA_SIZE);
+        return PACKET_DATA_SIZE;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Starts the transmission of a file, through its channel.
+ *
+ * @param bond The bond through which the transmission is being done.
+ * @param channel The channel of the file to transmit.
+ * @param n_channels The number of files transmitted at once.
+ * @param max_size The largest size of the file fragments that will be sent.
  *
  * @return 1 on success.
  * @return -1 on failure.
  */
-int init_transmission(LLConnection *connection, const char *filename) {
+int init_transmission(Bond *bond, const TxChannel *channel,
+                      uint8_t n_channels, size_t max_size) {
     struct stat st;
 
-    if (stat(filename, &st) != 0) {
+    if (fstat(channel->fd, &st) != 0) {
         ERROR("Could not determine size of file to transmit: %s",
               strerror(errno));
         return -1;
     }
 
-    if (send_packet(connection, create_start_packet(st.st_size, filename)) ==
-        -1) {
-        ERROR("Error sending START packet for file: %s\n", filename);
+    uint8_t compression = COMPRESSION ? COMPRESSION_LZ : COMPRESSION_NONE;
+
+    if (send_packet(bond, create_start_packet(
+                              channel->id, n_channels, st.st_size,
+                              channel->file_name, compression, max_size,
+                              channel->start, channel->prefix_hash)) == -1) {
+        ERROR("Error sending START packet for file: %s\n",
+              channel->file_name);
         return -1;
     }
 
@@ -75,22 +108,223 @@ int init_transmission(LLConnection *connection, const char *filename) {
     return 1;
 }
 
+/**
+ * @brief Checks that a partially received file can be resumed, and drops
+ *        what's past the resume offset.
+ *
+ * @param fd The file descriptor of the file.
+ * @param checkpoint The path of the checkpoint of the file.
+ * @param offset Where the transmitter resumes.
+ * @param prefix_hash The transmitter's #checkpoint_hash of the file up to
+ *                    offset.
+ *
+ * @return Whether the file can be resumed.
+ */
+bool can_resume(int fd, const char *checkpoint, off_t offset,
+                const uint8_t *prefix_hash) {
+    uint8_t hash[PREFIX_HASH_SIZE];
+
+    // Only what the checkpoint says is on disk can be trusted
+    if (offset > checkpoint_read(checkpoint) ||
+        checkpoint_hash(fd, offset, hash) == -1 ||
+        memcmp(hash, prefix_hash, PREFIX_HASH_SIZE) != 0)
+        return false;
+
+    return ftruncate(fd, offset) == 0;
+}
+
+/**
+ * @brief Handles a START packet, opening the file received through its
+ *        channel.
+ *
+ * @param bond The bond the packet was received from.
+ * @param channel The channel of the packet.
+ * @param packet_ptr The fields of the packet.
+ * @param packet_end The end of the packet.
+ * @param n_channels Where to write how many files are received at once, if
+ *                   the packet says.
+ *
+ * @return 0 on success.
+ * @return -1 on failure.
+ */
+int start_channel(Bond *bond, RxChannel *channel, const uint8_t *packet_ptr,
+                  const uint8_t *packet_end, size_t *n_channels) {
+    while (packet_ptr < packet_end) {
+        uint8_t type = *packet_ptr++;
+        uint8_t size = *packet_ptr++;
+
+        switch (type) {
+        case FILE_SIZE_FIELD:
+            for (uint8_t i = 0; i < size; ++i)
+                channel->file_size += (size_t)*packet_ptr++ << (8 * i);
+            break;
+        case FILE_NAME_FIELD: {
+
+            char tmp_file_name[size + 1];
+            memcpy(tmp_file_name, packet_ptr, size);
+            tmp_file_name[size] = '\0';
+
+            // split by the extension dot so that we can correctly
+            // construct the file name
+            char *first_token = strtok(tmp_file_name, ".");
+            char *second_token = strtok(NULL, ".");
+
+            if (second_token != NULL)
+                sprintf(channel->file_name, "%s_received.%s", first_token,
+                        second_token);
+            else
+                sprintf(channel->file_name, "%s_received", first_token);
+
+            packet_ptr += size;
+            break;
+        }
+        case COMPRESSION_FIELD:
+            channel->compression = *packet_ptr;
+            packet_ptr += size;
+            break;
+        case FRAGMENT_SIZE_FIELD:
+            channel->max_fragment_size = 0;
+            for (uint8_t i = 0; i < size; ++i)
+                channel->max_fragment_size += *packet_ptr++ << (8 * i);
+            break;
+        case RESUME_OFFSET_FIELD:
+            for (uint8_t i = 0; i < size; ++i)
+                channel->resume_offset += (off_t)*packet_ptr++ << (8 * i);
+            break;
+        case PREFIX_HASH_FIELD:
+            if (size == PREFIX_HASH_SIZE)
+                memcpy(channel->prefix_hash, packet_ptr, size);
+            packet_ptr += size;
+            break;
+        case CHANNELS_FIELD:
+            *n_channels = *packet_ptr;
+            packet_ptr += size;
+            break;
+        default:
+            // Fields from newer transmitters can be skipped
+            packet_ptr += size;
+            break;
+        }
+    }
+
+    if (channel->compression != COMPRESSION_NONE &&
+        channel->compression != COMPRESSION_LZ) {
+        ERROR("Unknown compression method %d, aborting\n",
+              channel->compression);
+        return -1;
+    }
+
+    // Fragments are written from slots of PACKET_DATA_SIZE bytes
+    if (channel->max_fragment_size > PACKET_DATA_SIZE) {
+        ERROR("Fragments of %lu bytes are too large, aborting\n",
+              channel->max_fragment_size);
+        return -1;
+    }
+
+    channel->fragment = malloc(channel->max_fragment_size);
+
+    if (channel->fragment == NULL) {
+        ERROR("Allocating fragment buffer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    INFO("Transferring file %s with size (in bytes) %lu\n",
+         channel->file_name, channel->file_size);
+
+    LOG("Opening file descriptor for file: %s\n", channel->file_name);
+
+    checkpoint_path(channel->checkpoint, sizeof(channel->checkpoint),
+                    channel->file_name);
+
+    channel->fd =
+        open(channel->file_name,
+             O_RDWR | O_CREAT | (channel->resume_offset == 0 ? O_TRUNC : 0),
+             0644);
+
+    if (channel->fd == -1) {
+        ERROR("Opening RX fd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (channel->resume_offset == 0) {
+        unlink(channel->checkpoint);
+    } else if (!can_resume(channel->fd, channel->checkpoint,
+                           channel->resume_offset, channel->prefix_hash)) {
+        // The transmitter drops its checkpoint and starts over
+        ERROR("Can't resume %s from byte %ld, disconnecting\n",
+              channel->file_name, channel->resume_offset);
+        bond_disconnect(bond);
+        return -1;
+    } else {
+        INFO("Resuming %s from byte %ld\n", channel->file_name,
+             channel->resume_offset);
+    }
+
+    // Written in the background, so acknowledgements don't wait on it
+    channel->writer = writer_create(channel->fd, channel->resume_offset,
+                                    channel->file_size, channel->checkpoint);
+
+    if (channel->writer == NULL) {
+        ERROR("Starting to write RX fd: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Finishes writing the file received through a channel, and drops
+ *        its checkpoint if it was received entirely.
+ *
+ * @param channel The channel.
+ */
+void finish_channel(RxChannel *channel) {
+    if (channel->writer != NULL && writer_destroy(channel->writer) == -1)
+        ERROR("Error writing the received file %s\n", channel->file_name);
+    else if (channel->complete && channel->writer != NULL)
+        unlink(channel->checkpoint);
+
+    if (channel->fd != -1)
+        close(channel->fd);
+
+    free(channel->fragment);
+
+    channel->writer = NULL;
+    channel->fd = -1;
+    channel->fragment = NULL;
+}
+
 /**
  * @brief Performs the receiver routine for this application instance.
  *
- * @param connection The connection to use to receive data from.
+ * @param bond The bond to use to receive data from.
  *
  * @return 1.
  */
-ssize_t receiver(LLConnection *connection) {
+ssize_t receiver(Bond *bond) {
     uint8_t *packet_ptr = NULL;
-    int fd = -1;
-    char file_name[256 + 9] = {0}; // Give space for "_received"
-    size_t file_size = 0;
-    uint8_t packet[PACKET_SIZE];
+    RxChannel channels[MAX_CHANNELS];
+    size_t n_channels = 1;
+    size_t n_ended = 0;
+
+    for (size_t i = 0; i < MAX_CHANNELS; ++i) {
+        memset(&channels[i], 0, sizeof(RxChannel));
+        channels[i].fd = -1;
+        channels[i].compression = COMPRESSION_NONE;
+        channels[i].max_fragment_size = PACKET_DATA_SIZE;
+    }
+
+    // Packets of every channel are interleaved, so any can come next
+    size_t packet_size = MAX(START_PACKET_SIZE, PACKET_SIZE);
+    uint8_t *packet = malloc(packet_size);
+
+    if (packet == NULL) {
+        ERROR("Allocating packet buffer: %s\n", strerror(errno));
+        return 1;
+    }
 
     while (true) {
-        ssize_t bytes_read = llread(connection, packet);
+        ssize_t bytes_read = bond_read_into(bond, packet, packet_size);
 
         if (bytes_read == -1) {
             ERROR("Error reading packet!\n");
@@ -103,127 +337,350 @@ ssize_t receiver(LLConnection *connection) {
         for (size_t i = 0; i < bytes_read; ++i)
             printf(" %02x", packet[i]);
         printf("\n");
-#else
-        INFO("Received packet\n");
 #endif
 
-        packet_ptr = packet;
-
-        LOG("Processing packet\n");
+        TRACE_EVENT(TRACE_PACKET_RECEIVED, packet[0], bytes_read);
 
-        uint8_t packet_type = *packet_ptr++;
+        packet_ptr = packet;
 
-        if (packet_type == END_PACKET)
+        if (bytes_read < 2 || packet[1] >= MAX_CHANNELS) {
+            ERROR("Critical: Received packet of unknown channel, "
+                  "aborting!\n");
             break;
-        else if (packet_type == START_PACKET) {
-            for (uint8_t *packet_end = packet + bytes_read;
-                 packet_ptr < packet_end;) {
-                uint8_t type = *packet_ptr++;
-                uint8_t size = *packet_ptr++;
-
-                switch (type) {
-                case FILE_SIZE_FIELD:
-                    for (uint8_t i = 0; i < size; ++i)
-                        file_size += *packet_ptr++ << (8 * i);
-                    break;
-                case FILE_NAME_FIELD: {
-
-                    char tmp_file_name[size + 1];
-                    memcpy(tmp_file_name, packet_ptr, size);
-                    tmp_file_name[size] = '\0';
+        }
 
-                    // split by the extension dot so that we can correctly
-                    // construct the file name
-                    char *first_token = strtok(tmp_file_name, ".");
-                    char *second_token = strtok(NULL, ".");
+        uint8_t packet_type = *packet_ptr++;
+        uint8_t channel_id = *packet_ptr++;
+        RxChannel *channel = &channels[channel_id];
 
-                    if (second_token != NULL)
-                        sprintf(file_name, "%s_received.%s", first_token,
-                                second_token);
-                    else
-                        sprintf(file_name, "%s_received", first_token);
+        if (packet_type == END_PACKET) {
+            channel->complete = true;
+            finish_channel(channel);
 
-                    packet_ptr += size;
-                    break;
-                }
-                }
+            if (++n_ended >= n_channels)
+                break;
+        } else if (packet_type == START_PACKET) {
+            if (channel->fd != -1 || channel->complete) {
+                ERROR("Critical: Received START packet twice on channel %d, "
+                      "aborting!\n",
+                      channel_id);
+                break;
             }
 
-            INFO("Transferring file %s with size (in bytes) %lu\n", file_name,
-                 file_size);
-
-            LOG("Opening file descriptor for file: %s\n", file_name);
+            if (start_channel(bond, channel, packet_ptr, packet + bytes_read,
+                              &n_channels) == -1)
+                break;
 
-            fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        } else if (packet_type == DATA_PACKET ||
+                   packet_type == COMPRESSED_DATA_PACKET) {
 
-            if (fd == -1) {
-                ERROR("Opening RX fd: %s\n", strerror(errno));
+            if (channel->writer == NULL) {
+                ERROR("Critical: Received DATA packet before START, "
+                      "aborting!\n");
                 break;
             }
 
-        } else if (packet_type == DATA_PACKET) {
+            if (bytes_read < DATA_HEADER_SIZE) {
+                ERROR("Critical: Received truncated DATA packet, "
+                      "aborting!\n");
+                break;
+            }
 
-            static uint8_t acc_sequence_number = 0;
             uint8_t rcv_sequence_number = *packet_ptr++;
 
-            if (acc_sequence_number++ != rcv_sequence_number) {
+            if (channel->sequence_number++ != rcv_sequence_number) {
                 ERROR("Critical: Received incorrect packet (expected=%d, "
                       "actual=%d), aborting!\n",
-                      acc_sequence_number, rcv_sequence_number);
+                      channel->sequence_number, rcv_sequence_number);
                 break;
             }
 
             uint8_t fragment_size_h = *packet_ptr++;
             uint8_t fragment_size_l = *packet_ptr++;
 
-            uint16_t fragment_size = (fragment_size_h << 8) | fragment_size_l;
+            ssize_t fragment_size = (fragment_size_h << 8) | fragment_size_l;
 
-            LOG("Writing %d bytes to %s\n", fragment_size, file_name);
+            // Fragments are written from slots of max_fragment_size bytes
+            if (fragment_size != bytes_read - DATA_HEADER_SIZE ||
+                fragment_size > channel->max_fragment_size) {
+                ERROR("Critical: Received DATA packet of wrong size "
+                      "(header=%ld, received=%ld), aborting!\n",
+                      fragment_size, bytes_read - DATA_HEADER_SIZE);
+                break;
+            }
 
-            ssize_t bytes_written = write(fd, packet_ptr, fragment_size);
-            static size_t total_bytes_written = 0;
+            if (packet_type == COMPRESSED_DATA_PACKET) {
+                // Bounded by what was received, not by what the header says
+                fragment_size = lz_decompress(
+                    channel->fragment, channel->max_fragment_size, packet_ptr,
+                    bytes_read - DATA_HEADER_SIZE);
 
-            if (bytes_written == -1) {
-                ERROR("Writing to RX fd: %s\n", strerror(errno));
-                break;
-            } else if (bytes_written != 0) {
-                total_bytes_written += bytes_written;
+                if (fragment_size == -1) {
+                    ERROR("Critical: Received malformed compressed packet, "
+                          "aborting!\n");
+                    break;
+                }
+
+                packet_ptr = channel->fragment;
+            }
 
-                INFO("Written %lf%% of the file\n",
-                     (double)(total_bytes_written * 100.0 / file_size));
+            if (writer_write(channel->writer, packet_ptr, fragment_size) ==
+                -1) {
+                ERROR("Writing to RX fd failed\n");
+                break;
             }
         }
     }
 
-    if (fd != -1)
-        close(fd);
+    // Whatever wasn't received entirely resumes from its checkpoint
+    for (size_t i = 0; i < MAX_CHANNELS; ++i)
+        finish_channel(&channels[i]);
+
+    free(packet);
 
     return 1;
 }
 
+/**
+ * @brief Finds where to resume sending a file from its checkpoint, and seeks
+ *        there.
+ *
+ * @param fd The file descriptor of the file.
+ * @param checkpoint The path of the checkpoint of the file.
+ * @param prefix_hash Where to write the #checkpoint_hash of the file up to
+ *                    the offset returned.
+ *
+ * @return The offset to resume from, 0 to start over.
+ */
+off_t resume_point(int fd, const char *checkpoint, uint8_t *prefix_hash) {
+    off_t offset = checkpoint_read(checkpoint);
+
+    if (offset == 0)
+        return 0;
+
+    if (checkpoint_hash(fd, offset, prefix_hash) == -1 ||
+        lseek(fd, offset, SEEK_SET) == -1) {
+        ALARM("Ignoring checkpoint %s, the file is shorter\n", checkpoint);
+        lseek(fd, 0, SEEK_SET);
+        return 0;
+    }
+
+    INFO("Resuming from byte %ld\n", offset);
+
+    return offset;
+}
+
+/**
+ * @brief Computes how much of a file the receiver acknowledged.
+ *
+ * @param bond The bond.
+ * @param channel The channel of the file.
+ * @param n_packets The number of packets sent, of every channel.
+ *
+ * @return The offset in the file.
+ */
+off_t acknowledged_offset(Bond *bond, const TxChannel *channel,
+                          uint64_t n_packets) {
+    // The packets still pending are the last ones sent, of any channel
+    uint64_t acknowledged = n_packets - MIN(bond_pending(bond), n_packets);
+
+    for (size_t k = 1; k <= MIN(channel->n_sent, BOND_WINDOW); ++k) {
+        size_t i = (channel->n_sent - k) % BOND_WINDOW;
+
+        if (channel->numbers[i] < acknowledged)
+            return channel->ends[i];
+    }
+
+    // Acknowledged before the packets remembered, at least up to the last
+    // checkpoint
+    return channel->saved;
+}
+
+/**
+ * @brief Computes how much of a file the receiver has surely recorded in its
+ *        own checkpoint, from how much of it was acknowledged.
+ *
+ * The receiver only records what its writer synced, up to
+ * #CHECKPOINT_INTERVAL bytes behind what it wrote, which is behind what was
+ * acknowledged by the fragments in its write behind ring and those not yet
+ * read from the bond. Resuming from further would be refused.
+ *
+ * @param channel The channel of the file.
+ * @param acknowledged The offset acknowledged, see #acknowledged_offset.
+ *
+ * @return The offset in the file.
+ */
+off_t durable_offset(const TxChannel *channel, off_t acknowledged) {
+    off_t behind = CHECKPOINT_INTERVAL + (off_t)(WRITE_BEHIND + BOND_WINDOW) *
+                                             channel->fragment_size;
+
+    return MAX(acknowledged - behind, channel->start);
+}
+
+/**
+ * @brief Opens the file sent through a channel, and starts reading it from
+ *        where its checkpoint says.
+ *
+ * @param channel The channel.
+ * @param max_size The largest size of the file fragments that will be sent.
+ *
+ * @return 0 on success.
+ * @return -1 on failure.
+ */
+int open_channel(TxChannel *channel, size_t max_size) {
+    channel->fd = open(channel->file_name, O_RDWR | O_NOCTTY);
+
+    if (channel->fd == -1) {
+        ERROR("Error opening file %s: %s\n", channel->file_name,
+              strerror(errno));
+        return -1;
+    }
+
+    channel->fragment_size = max_size;
+
+    checkpoint_path(channel->checkpoint, sizeof(channel->checkpoint),
+                    channel->file_name);
+
+    channel->start =
+        resume_point(channel->fd, channel->checkpoint, channel->prefix_hash);
+    channel->saved = channel->start;
+    channel->keep_checkpoint = true;
+
+    // Start reading the file while the START packets are sent
+    channel->reader = reader_create(channel->fd, COMPRESSION, max_size);
+
+    if (channel->reader == NULL) {
+        ERROR("Error starting to read file %s\n", channel->file_name);
+        close(channel->fd);
+        channel->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stops reading the file sent through a channel, and saves where to
+ *        resume it from if it wasn't sent entirely.
+ *
+ * @param bond The bond.
+ * @param channel The channel.
+ * @param n_packets The number of packets sent, of every channel.
+ */
+void close_channel(Bond *bond, TxChannel *channel, uint64_t n_packets) {
+    // Resumed from what the receiver can have saved, if it didn't finish
+    if (!channel->keep_checkpoint) {
+        unlink(channel->checkpoint);
+    } else {
+        off_t durable = durable_offset(
+            channel, acknowledged_offset(bond, channel, n_packets));
+
+        if (durable > 0 && checkpoint_write(channel->checkpoint, durable) == -1)
+            ALARM("Saving checkpoint %s: %s\n", channel->checkpoint,
+                  strerror(errno));
+    }
+
+    reader_destroy(channel->reader);
+    close(channel->fd);
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return The time, in seconds.
+ */
+double monotonic_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
 /**
  * @brief Performs the transmitter routine for this application instance.
  *
- * @param connection The connection to use to send data to.
- * @param filename The name of the file to send.
+ * Several files can be sent at once, each through its own channel, see
+ * #parse_channels. Their DATA packets are interleaved by #schedule_channel.
+ *
+ * @param bond The bond to use to send data to.
+ * @param filename The names of the files to send.
  *
  * @return 1.
  */
-ssize_t transmitter(LLConnection *connection, const char *filename) {
-    int fd = open(filename, O_RDWR | O_NOCTTY);
+ssize_t transmitter(Bond *bond, const char *filename) {
+    Scheduler scheduler;
+    size_t n_open = 0;
+    size_t max_size = max_fragment_size();
 
-    if (fd == -1) {
-        ERROR("Error opening file!");
-        return -1;
+    parse_channels(&scheduler, filename);
+
+    for (size_t i = 0; i < scheduler.n_channels; ++i) {
+        TxChannel *channel = &scheduler.channels[i];
+
+        // Files that can't be opened are left out, scheduled as done
+        if (open_channel(channel, max_size) == -1)
+            channel->done = true;
+        else
+            n_open++;
     }
 
-    if (init_transmission(connection, filename) == -1)
+    if (n_open == 0)
         return -1;
 
-    uint8_t packet_data[PACKET_DATA_SIZE];
+    uint64_t n_packets = 0;
+    bool failed = false;
+    bool refused = false;
 
-    while (true) {
-        int bytes_read = read(fd, packet_data, PACKET_DATA_SIZE);
+    for (size_t i = 0; i < scheduler.n_channels && !failed; ++i) {
+        TxChannel *channel = &scheduler.channels[i];
+
+        if (channel->done)
+            continue;
+
+        if (init_transmission(bond, channel, n_open, max_size) == -1)
+            failed = true;
+        else
+            n_packets++;
+    }
+
+    while (!failed) {
+        double now = monotonic_seconds();
+        double wait;
+        TxChannel *channel = schedule_channel(&scheduler, now, &wait);
+
+        if (channel == NULL && wait == 0)
+            break;
+
+        if (channel == NULL) {
+            // Every channel left is over its rate cap, so the link idles, but
+            // retransmissions can't wait
+            if (bond_pending(bond) == 0) {
+                usleep(wait * 1e6);
+            } else if (bond_flush(bond) == -1) {
+                ERROR("Error sending DATA packet\n");
+                refused = errno == ECONNRESET;
+                break;
+            }
+
+            continue;
+        }
+
+        // Smaller fragments lose less to errors, larger ones less to overhead
+        size_t next_size = adapt_fragment_size(
+            bond_error_rate(bond), channel->fragment_size, max_size);
+
+        if (next_size != channel->fragment_size) {
+            LOG("Changing fragment size from %lu to %lu bytes\n",
+                channel->fragment_size, next_size);
+
+            reader_set_fragment_size(channel->reader, next_size);
+            channel->fragment_size = next_size;
+        }
+
+        const uint8_t *packet_data;
+        bool compressed;
+        ssize_t bytes_read =
+            reader_next(channel->reader, &packet_data, &compressed);
 
         if (bytes_read == -1) {
             ERROR("Error reading file fragment, aborting");
@@ -232,21 +689,58 @@ ssize_t transmitter(LLConnection *connection, const char *filename) {
         } else if (bytes_read == 0) {
             // reached end of file, send END packet
 
-            if (send_packet(connection, create_end_packet()) == -1) {
+            if (send_packet(bond, create_end_packet(channel->id)) == -1) {
                 ERROR("Error sending END control packet\n");
+                break;
             }
 
-            break;
+            n_packets++;
+            channel->done = true;
+            channel->keep_checkpoint = false;
         } else {
-            if (send_packet(connection, create_data_packet(packet_data,
-                                                           bytes_read)) == -1) {
+            ssize_t result = send_data_packet(
+                bond, channel->id, channel->sequence_number++, packet_data,
+                bytes_read, compressed);
+            reader_release(channel->reader);
+
+            if (result == -1) {
                 ERROR("Error sending DATA packet\n");
+                refused = errno == ECONNRESET;
                 break;
             };
+
+            charge_channel(&scheduler, channel, result, now);
+
+            size_t i = channel->n_sent++ % BOND_WINDOW;
+            channel->numbers[i] = n_packets++;
+            channel->ends[i] = reader_offset(channel->reader);
+
+            off_t durable = durable_offset(
+                channel, acknowledged_offset(bond, channel, n_packets));
+
+            if (durable - channel->saved >= CHECKPOINT_INTERVAL &&
+                checkpoint_write(channel->checkpoint, durable) == 0)
+                channel->saved = durable;
         }
     }
 
-    close(fd);
+    for (size_t i = 0; i < scheduler.n_channels; ++i) {
+        TxChannel *channel = &scheduler.channels[i];
+
+        if (channel->fd == -1)
+            continue;
+
+        // It isn't known which file couldn't be resumed, so every resumed
+        // one starts over
+        if (refused && channel->start > 0) {
+            ERROR("The receiver refused to resume %s, run again to start "
+                  "over\n",
+                  channel->file_name);
+            channel->keep_checkpoint = false;
+        }
+
+        close_channel(bond, channel, n_packets);
+    }
 
     return 1;
 }
@@ -254,22 +748,22 @@ ssize_t transmitter(LLConnection *connection, const char *filename) {
 void application_layer(const char *serial_port, const char *role,
                        const char *filename) {
     LLRole llrole = strcmp(role, "rx") == 0 ? LL_RX : LL_TX;
-    LLConnection *connection = connect(serial_port, llrole);
+    Bond *bond = connect(serial_port, llrole);
 
     struct timespec start, end;
     clock_gettime(CLOCK_MONOTONIC, &start);
 
-    if (connection == NULL) {
+    if (bond == NULL) {
         ERROR("Error establishing connection.");
     }
 
     if (llrole == LL_RX) {
-        receiver(connection);
+        receiver(bond);
     } else {
-        transmitter(connection, filename);
+        transmitter(bond, filename);
     }
 
-    llclose(connection);
+    bond_close(bond, option("STATS", STATS));
 
     clock_gettime(CLOCK_MONOTONIC, &end);
 
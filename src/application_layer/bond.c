@@ -0,0 +1,523 @@
+#include "application_layer/bond.h"
+#include "application_layer/packet.h"
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/param.h>
+
+/**
+ * @brief The largest packet received through a link of a bond, with its
+ *        header.
+ */
+#define BOND_PACKET_SIZE                                                       \
+    (BOND_HEADER_SIZE + MAX(START_PACKET_SIZE, PACKET_SIZE))
+
+/**
+ * @brief Finds the oldest packet written to a bond that wasn't acknowledged.
+ *
+ * @note Must be called with the bond locked.
+ *
+ * @param bond The bond.
+ *
+ * @return The index of the packet, or #Bond::next_index if there is none.
+ */
+uint32_t oldest_unacknowledged(const Bond *bond) {
+    uint32_t oldest = bond->next_unsent;
+
+    for (size_t i = 0; i < bond->n_retries; ++i)
+        oldest = MIN(oldest, bond->retries[i]);
+
+    for (size_t i = 0; i < bond->n_links; ++i) {
+        const BondLink *link = &bond->links[i];
+
+        if (link->failed)
+            continue;
+
+        if (link->busy)
+            oldest = MIN(oldest, link->sending);
+
+        // Packets sent again can be older than the ones sent before them
+        for (size_t k = 1; k <= link->pending; ++k)
+            oldest =
+                MIN(oldest, link->sent[(link->n_sent - k) % SEQ_MODULO]);
+    }
+
+    return oldest;
+}
+
+/**
+ * @brief Marks a link of a bond as failed, and queues the packets it didn't
+ *        get acknowledged to be sent again through the others.
+ *
+ * @note Must be called with the bond locked, from the link's thread.
+ *
+ * @param link The link.
+ */
+void fail_link(BondLink *link) {
+    Bond *bond = link->bond;
+
+    if (bond->role == LL_TX) {
+        // The receiver may have some of them already, and drops them
+        link->pending = llpending(link->connection);
+
+        if (link->busy)
+            bond->retries[bond->n_retries++] = link->sending;
+
+        for (size_t k = 1; k <= link->pending; ++k)
+            bond->retries[bond->n_retries++] =
+                link->sent[(link->n_sent - k) % SEQ_MODULO];
+    }
+
+    if (errno == ECONNRESET || bond->error == 0)
+        bond->error = errno;
+
+    link->failed = true;
+    link->busy = false;
+    link->pending = 0;
+    bond->n_alive--;
+
+    LOG("Link %lu of the bond stopped, %lu left\n", link - bond->links,
+        bond->n_alive);
+
+    pthread_cond_broadcast(&bond->changed);
+}
+
+/**
+ * @brief Takes the next packet of a bond for a link to send, those to send
+ *        again first, oldest first.
+ *
+ * @note Must be called with the bond locked.
+ *
+ * @param bond The bond.
+ * @param index Where to write the index of the packet.
+ *
+ * @return Whether there was a packet to send.
+ */
+bool take_packet(Bond *bond, uint32_t *index) {
+    if (bond->n_retries > 0) {
+        size_t oldest = 0;
+
+        for (size_t i = 1; i < bond->n_retries; ++i)
+            if (bond->retries[i] < bond->retries[oldest])
+                oldest = i;
+
+        *index = bond->retries[oldest];
+        bond->retries[oldest] = bond->retries[--bond->n_retries];
+        return true;
+    }
+
+    if (bond->next_unsent != bond->next_index) {
+        *index = bond->next_unsent++;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Sends packets of a bond through one of its links, until the link
+ *        fails or the bond is closed and every packet was acknowledged.
+ *
+ * A link only takes a packet when its window has room, so that each one
+ * sends as many as its throughput allows, and waits for acknowledgements
+ * otherwise.
+ *
+ * @param arg The link.
+ *
+ * @return NULL.
+ */
+void *transmit_thread(void *arg) {
+    BondLink *link = arg;
+    Bond *bond = link->bond;
+    uint8_t header[BOND_HEADER_SIZE];
+
+    pthread_mutex_lock(&bond->lock);
+
+    while (true) {
+        uint32_t index;
+        int result;
+
+        if (link->pending < link->connection->window_size &&
+            take_packet(bond, &index)) {
+            link->busy = true;
+            link->sending = index;
+
+            // The slot isn't reused until the packet is acknowledged
+            const ByteVector *packet = bond->slots[index % BOND_WINDOW].data;
+            pthread_mutex_unlock(&bond->lock);
+
+            for (int i = 0; i < BOND_HEADER_SIZE; ++i)
+                header[i] = index >> (8 * i);
+
+            struct iovec iov[] = {
+                {.iov_base = header, .iov_len = sizeof(header)},
+                {.iov_base = packet->array, .iov_len = packet->length},
+            };
+
+            result = llwritev(link->connection, iov, 2) < 0 ? -1 : 0;
+
+            pthread_mutex_lock(&bond->lock);
+
+            if (result == 0) {
+                link->busy = false;
+                link->sent[link->n_sent++ % SEQ_MODULO] = index;
+            }
+        } else if (link->pending > 0) {
+            pthread_mutex_unlock(&bond->lock);
+            result = llsync(link->connection, link->pending - 1);
+            pthread_mutex_lock(&bond->lock);
+        } else if (bond->closing &&
+                   oldest_unacknowledged(bond) == bond->next_index) {
+            break;
+        } else {
+            // Until there's something to send, or another link fails
+            pthread_cond_wait(&bond->changed, &bond->lock);
+            continue;
+        }
+
+        if (result == -1) {
+            fail_link(link);
+            break;
+        }
+
+        link->pending = llpending(link->connection);
+        link->fer = llerror_rate(link->connection);
+        pthread_cond_broadcast(&bond->changed);
+    }
+
+    pthread_mutex_unlock(&bond->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Receives packets of a bond through one of its links, into their
+ *        slots, until the link fails or is closed.
+ *
+ * A link that stays silent for #BOND_CLOSE_TRIES times #TIMEOUT seconds once
+ * the bond is being closed is given up on, since the transmitter won't close
+ * it.
+ *
+ * @param arg The link.
+ *
+ * @return NULL.
+ */
+void *receive_thread(void *arg) {
+    BondLink *link = arg;
+    Bond *bond = link->bond;
+    uint8_t *packet = malloc(BOND_PACKET_SIZE);
+    unsigned int idle = 0;
+
+    if (packet == NULL)
+        ERROR("Allocating bond packet buffer: %s\n", strerror(errno));
+
+    // Wakes up now and then to check whether the bond is being closed
+    llset_read_timeout(link->connection, TIMEOUT * 1000);
+
+    while (packet != NULL) {
+        errno = 0;
+        ssize_t bytes_read =
+            llread_into(link->connection, packet, BOND_PACKET_SIZE);
+
+        if (bytes_read == -1 && errno == ETIMEDOUT) {
+            pthread_mutex_lock(&bond->lock);
+            bool closing = bond->closing;
+            bool disconnecting = bond->disconnecting;
+            pthread_mutex_unlock(&bond->lock);
+
+            if (disconnecting) {
+                llset_read_timeout(link->connection, -1);
+                lldisconnect(link->connection);
+                break;
+            }
+
+            if (closing && ++idle >= BOND_CLOSE_TRIES) {
+                ALARM("Link %lu of the bond went silent, giving up on it\n",
+                      link - bond->links);
+                break;
+            }
+
+            continue;
+        }
+
+        if (bytes_read < BOND_HEADER_SIZE)
+            break;
+
+        idle = 0;
+
+        pthread_mutex_lock(&bond->lock);
+
+        if (bond->disconnecting) {
+            pthread_mutex_unlock(&bond->lock);
+            llset_read_timeout(link->connection, -1);
+            lldisconnect(link->connection);
+            break;
+        }
+
+        uint32_t index = 0;
+        for (int i = 0; i < BOND_HEADER_SIZE; ++i)
+            index |= (uint32_t)packet[i] << (8 * i);
+
+        // The transmitter keeps packets within the window of the ones it
+        // knows arrived, which may not have been read yet
+        while (!bond->closing && index - bond->next_index < UINT32_MAX / 2 &&
+               index - bond->next_index >= BOND_WINDOW)
+            pthread_cond_wait(&bond->changed, &bond->lock);
+
+        BondSlot *slot = &bond->slots[index % BOND_WINDOW];
+
+        // Packets sent again after a link failed may have arrived already
+        if (!bond->closing && index - bond->next_index < BOND_WINDOW &&
+            !slot->full) {
+            bv_clear(slot->data);
+            bv_push(slot->data, packet + BOND_HEADER_SIZE,
+                    bytes_read - BOND_HEADER_SIZE);
+            slot->index = index;
+            slot->full = true;
+            pthread_cond_broadcast(&bond->changed);
+        }
+
+        pthread_mutex_unlock(&bond->lock);
+    }
+
+    free(packet);
+
+    pthread_mutex_lock(&bond->lock);
+    fail_link(link);
+    pthread_mutex_unlock(&bond->lock);
+
+    return NULL;
+}
+
+Bond *bond_open(const char *serial_ports, LLRole role) {
+    Bond *bond = calloc(1, sizeof(Bond));
+
+    if (bond == NULL)
+        return NULL;
+
+    bond->role = role;
+    bond->striped = strstr(serial_ports, BOND_SEPARATOR) != NULL;
+
+    char ports[strlen(serial_ports) + 1];
+    strcpy(ports, serial_ports);
+
+    char *state;
+
+    for (char *port = strtok_r(ports, BOND_SEPARATOR, &state); port != NULL;
+         port = strtok_r(NULL, BOND_SEPARATOR, &state)) {
+        if (bond->n_links == BOND_MAX_LINKS) {
+            ALARM("Bonding only the first %d serial ports\n", BOND_MAX_LINKS);
+            break;
+        }
+
+        LOG("Connecting to %s\n", port);
+
+        LLConnection *connection = llopen(port, role);
+
+        if (connection == NULL) {
+            ALARM("Serial connection on port %s not available, leaving it "
+                  "out\n",
+                  port);
+            continue;
+        }
+
+        BondLink *link = &bond->links[bond->n_links++];
+        link->bond = bond;
+        link->connection = connection;
+    }
+
+    if (bond->n_links == 0) {
+        free(bond);
+        return NULL;
+    }
+
+    bond->n_alive = bond->n_links;
+
+    if (!bond->striped)
+        return bond;
+
+    pthread_mutex_init(&bond->lock, NULL);
+    pthread_cond_init(&bond->changed, NULL);
+
+    for (size_t i = 0; i < BOND_WINDOW; ++i)
+        bond->slots[i].data = bv_create();
+
+    for (size_t i = 0; i < bond->n_links; ++i) {
+        BondLink *link = &bond->links[i];
+
+        link->started =
+            pthread_create(&link->thread, NULL,
+                           role == LL_TX ? transmit_thread : receive_thread,
+                           link) == 0;
+
+        if (!link->started) {
+            ERROR("Starting thread of link %lu of the bond\n", i);
+            link->failed = true;
+            bond->n_alive--;
+        }
+    }
+
+    INFO("Bonded %lu serial ports\n", bond->n_links);
+
+    return bond;
+}
+
+ssize_t bond_writev(Bond *bond, const struct iovec *iov, int iovcnt) {
+    if (!bond->striped)
+        return llwritev(bond->links[0].connection, iov, iovcnt);
+
+    pthread_mutex_lock(&bond->lock);
+
+    while (bond->n_alive > 0 &&
+           bond->next_index - oldest_unacknowledged(bond) >= BOND_WINDOW)
+        pthread_cond_wait(&bond->changed, &bond->lock);
+
+    if (bond->n_alive == 0) {
+        pthread_mutex_unlock(&bond->lock);
+        errno = bond->error;
+        return -1;
+    }
+
+    BondSlot *slot = &bond->slots[bond->next_index % BOND_WINDOW];
+    bv_clear(slot->data);
+
+    for (int i = 0; i < iovcnt; ++i)
+        bv_push(slot->data, iov[i].iov_base, iov[i].iov_len);
+
+    slot->index = bond->next_index++;
+    ssize_t size = slot->data->length;
+
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+
+    return size;
+}
+
+ssize_t bond_read_into(Bond *bond, uint8_t *buf, size_t buf_size) {
+    if (!bond->striped)
+        return llread_into(bond->links[0].connection, buf, buf_size);
+
+    pthread_mutex_lock(&bond->lock);
+
+    BondSlot *slot = &bond->slots[bond->next_index % BOND_WINDOW];
+
+    while (!slot->full && bond->n_alive > 0)
+        pthread_cond_wait(&bond->changed, &bond->lock);
+
+    if (!slot->full) {
+        pthread_mutex_unlock(&bond->lock);
+        return -1;
+    }
+
+    ssize_t size = slot->data->length;
+
+    if (slot->data->length <= buf_size)
+        memcpy(buf, slot->data->array, slot->data->length);
+    else
+        size = -1;
+
+    slot->full = false;
+    bond->next_index++;
+
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+
+    return size;
+}
+
+size_t bond_pending(Bond *bond) {
+    if (!bond->striped)
+        return llpending(bond->links[0].connection);
+
+    pthread_mutex_lock(&bond->lock);
+    size_t pending = bond->next_index - oldest_unacknowledged(bond);
+    pthread_mutex_unlock(&bond->lock);
+
+    return pending;
+}
+
+int bond_flush(Bond *bond) {
+    if (!bond->striped)
+        return llsync(bond->links[0].connection, 0);
+
+    pthread_mutex_lock(&bond->lock);
+
+    while (bond->n_alive > 0 &&
+           oldest_unacknowledged(bond) != bond->next_index)
+        pthread_cond_wait(&bond->changed, &bond->lock);
+
+    int result = bond->n_alive > 0 ? 0 : -1;
+
+    if (result == -1)
+        errno = bond->error;
+
+    pthread_mutex_unlock(&bond->lock);
+
+    return result;
+}
+
+double bond_error_rate(Bond *bond) {
+    if (!bond->striped)
+        return llerror_rate(bond->links[0].connection);
+
+    double fer = 0;
+
+    pthread_mutex_lock(&bond->lock);
+
+    for (size_t i = 0; i < bond->n_links; ++i)
+        if (!bond->links[i].failed)
+            fer += bond->links[i].fer;
+
+    if (bond->n_alive > 0)
+        fer /= bond->n_alive;
+
+    pthread_mutex_unlock(&bond->lock);
+
+    return fer;
+}
+
+void bond_disconnect(Bond *bond) {
+    if (!bond->striped) {
+        lldisconnect(bond->links[0].connection);
+        return;
+    }
+
+    pthread_mutex_lock(&bond->lock);
+    bond->disconnecting = true;
+    pthread_cond_broadcast(&bond->changed);
+    pthread_mutex_unlock(&bond->lock);
+}
+
+void bond_close(Bond *bond, LLStatsFormat show_stats) {
+    if (bond->striped) {
+        pthread_mutex_lock(&bond->lock);
+        bond->closing = true;
+        pthread_cond_broadcast(&bond->changed);
+        pthread_mutex_unlock(&bond->lock);
+
+        // The receiver's links stop once the transmitter closes them, or
+        // they went silent for too long
+        for (size_t i = 0; i < bond->n_links; ++i)
+            if (bond->links[i].started)
+                pthread_join(bond->links[i].thread, NULL);
+
+        for (size_t i = 0; i < BOND_WINDOW; ++i)
+            bv_destroy(bond->slots[i].data);
+
+        pthread_cond_destroy(&bond->changed);
+        pthread_mutex_destroy(&bond->lock);
+    }
+
+    for (size_t i = 0; i < bond->n_links; ++i) {
+        BondLink *link = &bond->links[i];
+
+        // A link that went silent wouldn't answer a DISC either
+        if (link->failed)
+            link->connection->closed = true;
+
+        llclose(link->connection, show_stats);
+    }
+
+    free(bond);
+}
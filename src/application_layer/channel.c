@@ -0,0 +1,95 @@
+#include "application_layer/channel.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+size_t parse_channels(Scheduler *scheduler, const char *files) {
+    char list[strlen(files) + 1];
+    strcpy(list, files);
+
+    char *state;
+    scheduler->n_channels = 0;
+    scheduler->virtual_time = 0;
+
+    for (char *file = strtok_r(list, CHANNEL_SEPARATOR, &state); file != NULL;
+         file = strtok_r(NULL, CHANNEL_SEPARATOR, &state)) {
+        if (scheduler->n_channels == MAX_CHANNELS) {
+            ALARM("Sending only the first %d files\n", MAX_CHANNELS);
+            break;
+        }
+
+        TxChannel *channel = &scheduler->channels[scheduler->n_channels];
+        memset(channel, 0, sizeof(TxChannel));
+
+        // Options can be left empty, as in "log.txt::2000"
+        char *name = strsep(&file, CHANNEL_OPTION_SEPARATOR);
+        char *weight = strsep(&file, CHANNEL_OPTION_SEPARATOR);
+        char *rate = strsep(&file, CHANNEL_OPTION_SEPARATOR);
+
+        snprintf(channel->file_name, sizeof(channel->file_name), "%s", name);
+        channel->id = scheduler->n_channels++;
+        channel->fd = -1;
+        channel->weight =
+            weight != NULL && *weight != '\0' ? atof(weight) : 1;
+        channel->rate = rate != NULL ? atof(rate) : 0;
+
+        if (channel->weight <= 0) {
+            ALARM("The weight of %s must be positive, using 1\n", name);
+            channel->weight = 1;
+        }
+
+        if (channel->rate < 0)
+            channel->rate = 0;
+    }
+
+    return scheduler->n_channels;
+}
+
+TxChannel *schedule_channel(Scheduler *scheduler, double now, double *wait) {
+    TxChannel *next = NULL;
+    double next_start = 0;
+    *wait = 0;
+
+    for (size_t i = 0; i < scheduler->n_channels; ++i) {
+        TxChannel *channel = &scheduler->channels[i];
+
+        if (channel->done)
+            continue;
+
+        if (channel->next_allowed > now) {
+            double until = channel->next_allowed - now;
+
+            if (*wait == 0 || until < *wait)
+                *wait = until;
+
+            continue;
+        }
+
+        double start = MAX(channel->finish, scheduler->virtual_time);
+
+        if (next == NULL || start < next_start) {
+            next = channel;
+            next_start = start;
+        }
+    }
+
+    return next;
+}
+
+void charge_channel(Scheduler *scheduler, TxChannel *channel, size_t size,
+                    double now) {
+    double start = MAX(channel->finish, scheduler->virtual_time);
+
+    scheduler->virtual_time = start;
+    channel->finish = start + size / channel->weight;
+
+    // Sending up to a packet late is made up for, but capped channels don't
+    // save up for bursts while they wait
+    if (channel->rate > 0) {
+        double interval = size / channel->rate;
+        channel->next_allowed =
+            MAX(channel->next_allowed, now - interval) + interval;
+    }
+}
@@ -0,0 +1,84 @@
+#include "application_layer/checkpoint.h"
+#include "link_layer/fcs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief The size of the chunks a file is read in to be hashed.
+ */
+#define HASH_CHUNK_SIZE 65536
+
+void checkpoint_path(char *dst, size_t size, const char *file_name) {
+    snprintf(dst, size, "%s" CHECKPOINT_SUFFIX, file_name);
+}
+
+off_t checkpoint_read(const char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+        return 0;
+
+    long long offset;
+
+    if (fscanf(file, "%lld", &offset) != 1 || offset < 0)
+        offset = 0;
+
+    fclose(file);
+
+    return offset;
+}
+
+int checkpoint_write(const char *path, off_t offset) {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1)
+        return -1;
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%lld\n", (long long)offset);
+
+    // Renamed only once it's complete and on disk
+    if (write(fd, buf, len) != len || fsync(fd) == -1) {
+        int error = errno;
+        close(fd);
+        unlink(tmp_path);
+        errno = error;
+        return -1;
+    }
+
+    close(fd);
+
+    return rename(tmp_path, path);
+}
+
+int checkpoint_hash(int fd, off_t length, uint8_t *hash) {
+    uint8_t chunk[HASH_CHUNK_SIZE];
+    Fcs fcs;
+    fcs_init(&fcs, LL_CRC32);
+
+    for (off_t offset = 0; offset < length;) {
+        size_t n = length - offset < HASH_CHUNK_SIZE ? length - offset
+                                                     : HASH_CHUNK_SIZE;
+        ssize_t bytes_read = pread(fd, chunk, n, offset);
+
+        if (bytes_read == -1 && errno == EINTR)
+            continue;
+        if (bytes_read <= 0)
+            return -1;
+
+        fcs_update(&fcs, chunk, bytes_read);
+        offset += bytes_read;
+    }
+
+    fcs_final(&fcs, hash);
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "application_layer/compression.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+
+/**
+ * @brief The shortest match worth encoding.
+ */
+#define MIN_MATCH 4
+/**
+ * @brief How many bytes at the end of a block are always literals.
+ */
+#define LAST_LITERALS 5
+/**
+ * @brief How close to the end of a block a match may start.
+ */
+#define MATCH_LIMIT 12
+/**
+ * @brief The number of bits of the hash of 4 bytes used to find matches.
+ */
+#define HASH_BITS 12
+/**
+ * @brief The value of a length nibble meaning that more length bytes follow.
+ */
+#define RUN_MASK 15
+
+/**
+ * @brief Reads 4 bytes from a possibly unaligned address.
+ */
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Hashes 4 bytes into an index of the match table.
+ */
+static inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+double lz_entropy(const uint8_t *buf, size_t len) {
+    size_t counts[256] = {0};
+
+    for (size_t i = 0; i < len; ++i)
+        counts[buf[i]]++;
+
+    double entropy = 0;
+
+    for (int b = 0; b < 256; ++b) {
+        if (counts[b] == 0)
+            continue;
+
+        double p = (double)counts[b] / len;
+        entropy -= p * log2(p);
+    }
+
+    return entropy;
+}
+
+/**
+ * @brief Writes what's left of a length that doesn't fit in its nibble, as
+ *        a run of 255s and a last smaller byte.
+ *
+ * @param op Where to write the length.
+ * @param len The length, minus #RUN_MASK.
+ *
+ * @return Where the length ends.
+ */
+uint8_t *write_length(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+
+    *op++ = len;
+    return op;
+}
+
+/**
+ * @brief Writes a sequence, a run of literals optionally followed by a match.
+ *
+ * @param op Where to write the sequence.
+ * @param op_end The end of the output.
+ * @param literals The literals.
+ * @param n_literals The number of literals.
+ * @param offset How far back the match is, 0 if there is none.
+ * @param match_len The length of the match.
+ *
+ * @return Where the sequence ends.
+ * @return NULL if it doesn't fit in the output.
+ */
+uint8_t *write_sequence(uint8_t *op, const uint8_t *op_end,
+                        const uint8_t *literals, size_t n_literals,
+                        size_t offset, size_t match_len) {
+    size_t worst =
+        1 + n_literals / 255 + 1 + n_literals + 2 + match_len / 255 + 1;
+
+    if (worst > (size_t)(op_end - op))
+        return NULL;
+
+    uint8_t *token = op++;
+    *token = MIN(n_literals, RUN_MASK) << 4;
+
+    if (n_literals >= RUN_MASK)
+        op = write_length(op, n_literals - RUN_MASK);
+
+    memcpy(op, literals, n_literals);
+    op += n_literals;
+
+    if (offset == 0)
+        return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+
+    match_len -= MIN_MATCH;
+    *token |= MIN(match_len, RUN_MASK);
+
+    if (match_len >= RUN_MASK)
+        op = write_length(op, match_len - RUN_MASK);
+
+    return op;
+}
+
+size_t lz_compress(uint8_t *dst, size_t capacity, const uint8_t *src,
+                   size_t len) {
+    // Positions fit in 16 bits, as blocks are at most 64KiB
+    uint16_t table[1 << HASH_BITS] = {0};
+
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst, *op_end = dst + capacity;
+
+    if (len > MATCH_LIMIT) {
+        const uint8_t *limit = end - MATCH_LIMIT;
+        const uint8_t *match_end = end - LAST_LITERALS;
+
+        while (ip < limit) {
+            uint32_t h = hash(read32(ip));
+            const uint8_t *ref = src + table[h];
+            table[h] = ip - src;
+
+            if (ref >= ip || read32(ref) != read32(ip)) {
+                ip++;
+                continue;
+            }
+
+            size_t match_len = MIN_MATCH;
+
+            while (ip + match_len < match_end &&
+                   ref[match_len] == ip[match_len])
+                match_len++;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+                match_len++;
+            }
+
+            op = write_sequence(op, op_end, anchor, ip - anchor, ip - ref,
+                                match_len);
+
+            if (op == NULL)
+                return 0;
+
+            ip += match_len;
+            anchor = ip;
+
+            // Let the next match start inside this one
+            if (ip < limit)
+                table[hash(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    op = write_sequence(op, op_end, anchor, end - anchor, 0, 0);
+
+    return op == NULL ? 0 : (size_t)(op - dst);
+}
+
+/**
+ * @brief Reads what's left of a length whose nibble was #RUN_MASK.
+ *
+ * @param ip Where the length starts, moved to where it ends.
+ * @param end The end of the input.
+ * @param len The length, which is added to.
+ *
+ * @return -1 if the input ends first.
+ */
+int read_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t byte;
+
+    do {
+        if (*ip == end)
+            return -1;
+
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+
+    return 0;
+}
+
+ssize_t lz_decompress(uint8_t *dst, size_t capacity, const uint8_t *src,
+                      size_t len) {
+    const uint8_t *ip = src, *end = src + len;
+    size_t o = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t n_literals = token >> 4;
+
+        if (n_literals == RUN_MASK && read_length(&ip, end, &n_literals) == -1)
+            return -1;
+
+        if (n_literals > (size_t)(end - ip) || n_literals > capacity - o)
+            return -1;
+
+        memcpy(dst + o, ip, n_literals);
+        ip += n_literals;
+        o += n_literals;
+
+        // The last sequence has no match
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+
+        size_t match_len = token & RUN_MASK;
+
+        if (match_len == RUN_MASK && read_length(&ip, end, &match_len) == -1)
+            return -1;
+
+        match_len += MIN_MATCH;
+
+        if (offset == 0 || offset > o || match_len > capacity - o)
+            return -1;
+
+        // Overlapping matches repeat their last offset bytes
+        if (offset >= match_len) {
+            memcpy(dst + o, dst + o - offset, match_len);
+        } else {
+            for (size_t i = 0; i < match_len; ++i)
+                dst[o + i] = dst[o - offset + i];
+        }
+
+        o += match_len;
+    }
+
+    return o;
+}
+
+size_t compress_block(uint8_t *dst, size_t capacity, const uint8_t *src,
+                      size_t len) {
+    if (len == 0 || lz_entropy(src, len) > ENTROPY_THRESHOLD)
+        return 0;
+
+    // Only worth it if the block gets smaller
+    return lz_compress(dst, MIN(capacity, len - 1), src, len);
+}
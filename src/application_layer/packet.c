@@ -1,57 +1,139 @@
 #include "application_layer/packet.h"
 #include "byte_vector.h"
 
+#include <math.h>
 #include <string.h>
+#include <sys/param.h>
 #include <unistd.h>
 
-ByteVector *create_start_packet(size_t file_size, const char *file_name) {
-    ByteVector *bv = bv_create();
-
-    bv_pushb(bv, START_PACKET);
+/**
+ * @brief The bytes sent for each DATA packet besides its data fragment: the
+ *        packet header, the frame header, check and flags, and the #RR.
+ */
+#define FRAGMENT_OVERHEAD                                                      \
+    (DATA_HEADER_SIZE + 4 + FCS_MAX_SIZE + 1 + CONTROL_FRAME_SIZE)
 
-    bv_pushb(bv, FILE_SIZE_FIELD);
+/**
+ * @brief Pushes a field with a number, in as few little endian bytes as
+ *        needed, into a packet.
+ *
+ * @param bv The packet.
+ * @param type The type of the field.
+ * @param value The number.
+ */
+void push_number_field(ByteVector *bv, uint8_t type, uint64_t value) {
+    bv_pushb(bv, type);
     size_t i = bv->length;
     bv_pushb(bv, 0);
-    while (file_size > 0) {
-        bv_pushb(bv, (uint8_t)(file_size & 0xFF));
+    while (value > 0) {
+        bv_pushb(bv, (uint8_t)(value & 0xFF));
         bv_set(bv, i, bv_get(bv, i) + 1);
-        file_size = file_size >> 8;
+        value = value >> 8;
     }
+}
 
-    bv_pushb(bv, FILE_NAME_FIELD);
+ByteVector *create_start_packet(uint8_t channel, uint8_t n_channels,
+                                size_t file_size, const char *file_name,
+                                uint8_t compression,
+                                uint16_t max_fragment_size,
+                                off_t resume_offset,
+                                const uint8_t *prefix_hash) {
     size_t file_name_size = strlen(file_name);
     if (file_name_size > 255)
         file_name_size = 255;
+
+    ByteVector *bv = bv_create();
+    bv_reserve(bv, START_PACKET_SIZE);
+
+    bv_pushb(bv, START_PACKET);
+    bv_pushb(bv, channel);
+
+    push_number_field(bv, FILE_SIZE_FIELD, file_size);
+
+    bv_pushb(bv, FILE_NAME_FIELD);
     bv_pushb(bv, file_name_size);
     bv_push(bv, (const uint8_t *)file_name, file_name_size);
 
-    return bv;
-}
+    if (compression != COMPRESSION_NONE) {
+        bv_pushb(bv, COMPRESSION_FIELD);
+        bv_pushb(bv, 1);
+        bv_pushb(bv, compression);
+    }
 
-ByteVector *create_data_packet(const uint8_t *buf, uint16_t size) {
-    static uint8_t sequence_number = 0;
+    bv_pushb(bv, FRAGMENT_SIZE_FIELD);
+    bv_pushb(bv, 2);
+    bv_pushb(bv, (uint8_t)(max_fragment_size & 0xFF));
+    bv_pushb(bv, (uint8_t)(max_fragment_size >> 8));
 
-    ByteVector *bv = bv_create();
+    if (resume_offset > 0) {
+        push_number_field(bv, RESUME_OFFSET_FIELD, resume_offset);
+
+        bv_pushb(bv, PREFIX_HASH_FIELD);
+        bv_pushb(bv, PREFIX_HASH_SIZE);
+        bv_push(bv, prefix_hash, PREFIX_HASH_SIZE);
+    }
 
-    bv_pushb(bv, DATA_PACKET);
-    bv_pushb(bv, sequence_number++);
-    bv_pushb(bv, (uint8_t)((size & 0xFF00) >> 8));
-    bv_pushb(bv, (uint8_t)(size & 0xFF));
-    bv_push(bv, buf, size);
+    if (n_channels > 1) {
+        bv_pushb(bv, CHANNELS_FIELD);
+        bv_pushb(bv, 1);
+        bv_pushb(bv, n_channels);
+    }
 
     return bv;
 }
 
-ByteVector *create_end_packet() {
+ByteVector *create_end_packet(uint8_t channel) {
     ByteVector *bv = bv_create();
 
     bv_pushb(bv, END_PACKET);
+    bv_pushb(bv, channel);
 
     return bv;
 }
 
-ssize_t send_packet(LLConnection *connection, ByteVector *packet) {
-    ssize_t result = llwrite(connection, packet->array, packet->length);
+ssize_t send_packet(Bond *bond, ByteVector *packet) {
+    struct iovec iov = {.iov_base = packet->array, .iov_len = packet->length};
+    ssize_t result = bond_writev(bond, &iov, 1);
     bv_destroy(packet);
     return result;
 }
+
+ssize_t send_data_packet(Bond *bond, uint8_t channel, uint8_t sequence_number,
+                         const uint8_t *buf, uint16_t size, bool compressed) {
+    uint8_t header[DATA_HEADER_SIZE] = {
+        compressed ? COMPRESSED_DATA_PACKET : DATA_PACKET,
+        channel,
+        sequence_number,
+        (uint8_t)((size & 0xFF00) >> 8),
+        (uint8_t)(size & 0xFF),
+    };
+
+    struct iovec iov[] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = (uint8_t *)buf, .iov_len = size},
+    };
+
+    return bond_writev(bond, iov, 2);
+}
+
+size_t adapt_fragment_size(double fer, size_t fragment_size,
+                           size_t max_size) {
+    size_t min_size = MIN(MIN_PACKET_DATA_SIZE, max_size);
+
+    if (fer <= 0)
+        return max_size;
+    if (fer >= 1)
+        return min_size;
+
+    // The probability of a byte arriving intact, as a logarithm
+    double h = FRAGMENT_OVERHEAD;
+    double log_q = log(1 - fer) / (fragment_size + h);
+
+    // Maximizes the goodput L / (L + h) * q^(L + h)
+    double best = (-h + sqrt(h * h - 4 * h / log_q)) / 2;
+
+    // A single error weighs a lot in the estimate, so change gradually
+    size_t size = MAX(fragment_size / 2, MIN(2 * fragment_size, (size_t)best));
+
+    return MAX(min_size, MIN(max_size, size));
+}
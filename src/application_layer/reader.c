@@ -0,0 +1,300 @@
+#include "application_layer/reader.h"
+#include "log.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Reads fragments of a file into a reader's ring until the end of the
+ *        file, an error, or the reader is destroyed.
+ *
+ * @param arg The reader.
+ *
+ * @return NULL.
+ */
+void *reader_thread(void *arg) {
+    FileReader *reader = arg;
+    ssize_t size;
+
+    do {
+        pthread_mutex_lock(&reader->lock);
+
+        while (reader->count == READ_AHEAD && !reader->stop)
+            pthread_cond_wait(&reader->not_full, &reader->lock);
+
+        if (reader->stop) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+
+        size_t slot = (reader->head + reader->count) % READ_AHEAD;
+        size_t fragment_size = reader->fragment_size;
+
+        // The slot isn't visible to the consumer until count is incremented
+        pthread_mutex_unlock(&reader->lock);
+
+        size = read(reader->fd, reader->fragments[slot], fragment_size);
+
+        if (size == -1)
+            ERROR("Reading file fragment: %s\n", strerror(errno));
+
+        pthread_mutex_lock(&reader->lock);
+        reader->sizes[slot] = size;
+        reader->block_sizes[slot] = 0;
+        reader->done[slot] = !reader->compress;
+        reader->count++;
+        pthread_cond_signal(reader->compress ? &reader->readable
+                                             : &reader->not_empty);
+        pthread_mutex_unlock(&reader->lock);
+    } while (size > 0);
+
+    return NULL;
+}
+
+/**
+ * @brief Compresses fragments from a reader's ring, in the order they were
+ *        read, until the reader is destroyed.
+ *
+ * @param arg The reader.
+ *
+ * @return NULL.
+ */
+void *compress_thread(void *arg) {
+    FileReader *reader = arg;
+
+    pthread_mutex_lock(&reader->lock);
+
+    while (true) {
+        while (reader->claimed == reader->count && !reader->stop)
+            pthread_cond_wait(&reader->readable, &reader->lock);
+
+        if (reader->stop)
+            break;
+
+        size_t slot = (reader->head + reader->claimed) % READ_AHEAD;
+        reader->claimed++;
+
+        // Other workers compress other slots in the meantime
+        pthread_mutex_unlock(&reader->lock);
+
+        if (reader->sizes[slot] > 0)
+            reader->block_sizes[slot] =
+                compress_block(reader->blocks[slot], PACKET_DATA_SIZE,
+                               reader->fragments[slot], reader->sizes[slot]);
+
+        TRACE_EVENT(TRACE_FRAGMENT_COMPRESSED, 0, reader->block_sizes[slot]);
+
+        pthread_mutex_lock(&reader->lock);
+        reader->done[slot] = true;
+        pthread_cond_signal(&reader->not_empty);
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Starts the threads compressing the fragments of a reader.
+ *
+ * @param reader The reader.
+ */
+void start_workers(FileReader *reader) {
+    long n = COMPRESS_THREADS;
+
+    if (n <= 0)
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    n = MAX(1, MIN(n, READ_AHEAD));
+
+    for (reader->n_workers = 0; reader->n_workers < (size_t)n;
+         ++reader->n_workers)
+        if (pthread_create(&reader->workers[reader->n_workers], NULL,
+                           compress_thread, reader) != 0)
+            break;
+
+    // Fragments can still be sent as they are
+    if (reader->n_workers == 0)
+        reader->compress = false;
+}
+
+/**
+ * @brief Stops the threads of a reader.
+ *
+ * @param reader The reader.
+ */
+void stop_threads(FileReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = true;
+    pthread_cond_signal(&reader->not_full);
+    pthread_cond_broadcast(&reader->readable);
+    pthread_mutex_unlock(&reader->lock);
+
+    for (size_t i = 0; i < reader->n_workers; ++i)
+        pthread_join(reader->workers[i], NULL);
+}
+
+/**
+ * @brief Maps the file of a reader into memory.
+ *
+ * @param reader The reader.
+ *
+ * @return -1 if the file can't be mapped, and must be read instead.
+ */
+int map_tx_file(FileReader *reader) {
+    struct stat st;
+
+    if (fstat(reader->fd, &st) == -1 || st.st_size == 0 ||
+        reader->position > (size_t)st.st_size)
+        return -1;
+
+    void *mapping =
+        mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        ALARM("Mapping TX file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    reader->mapping = mapping;
+    reader->mapping_size = st.st_size;
+
+    return 0;
+}
+
+FileReader *reader_create(int fd, bool compress, size_t fragment_size) {
+    FileReader *reader = malloc(sizeof(FileReader));
+
+    if (reader == NULL)
+        return NULL;
+
+    reader->fd = fd;
+    reader->mapping = NULL;
+    reader->position = lseek(fd, 0, SEEK_CUR);
+    reader->compress = compress;
+    reader->fragment_size = fragment_size;
+    reader->n_workers = 0;
+    reader->head = 0;
+    reader->count = 0;
+    reader->claimed = 0;
+    reader->stop = false;
+
+    // Compressed fragments are copied anyway, so mapping gains nothing
+    if (MMAP && !compress && map_tx_file(reader) == 0)
+        return reader;
+
+    // The file is read once, from start to end
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->not_empty, NULL);
+    pthread_cond_init(&reader->readable, NULL);
+    pthread_cond_init(&reader->not_full, NULL);
+
+    if (reader->compress)
+        start_workers(reader);
+
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader) != 0) {
+        stop_threads(reader);
+        pthread_cond_destroy(&reader->not_full);
+        pthread_cond_destroy(&reader->readable);
+        pthread_cond_destroy(&reader->not_empty);
+        pthread_mutex_destroy(&reader->lock);
+        free(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+ssize_t reader_next(FileReader *reader, const uint8_t **fragment,
+                    bool *compressed) {
+    *compressed = false;
+
+    if (reader->mapping != NULL) {
+        size_t size =
+            MIN(reader->fragment_size, reader->mapping_size - reader->position);
+
+        *fragment = reader->mapping + reader->position;
+        reader->position += size;
+
+        return size;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+
+    // Fragments may finish compressing out of order, but are sent in order
+    while (reader->count == 0 || !reader->done[reader->head])
+        pthread_cond_wait(&reader->not_empty, &reader->lock);
+
+    size_t slot = reader->head;
+
+    pthread_mutex_unlock(&reader->lock);
+
+    if (reader->sizes[slot] > 0)
+        reader->position += reader->sizes[slot];
+
+    if (reader->block_sizes[slot] > 0) {
+        *fragment = reader->blocks[slot];
+        *compressed = true;
+        return reader->block_sizes[slot];
+    }
+
+    *fragment = reader->fragments[slot];
+    return reader->sizes[slot];
+}
+
+void reader_release(FileReader *reader) {
+    if (reader->mapping != NULL)
+        return;
+
+    pthread_mutex_lock(&reader->lock);
+
+    reader->done[reader->head] = false;
+    reader->head = (reader->head + 1) % READ_AHEAD;
+    reader->count--;
+    if (reader->compress)
+        reader->claimed--;
+    pthread_cond_signal(&reader->not_full);
+
+    pthread_mutex_unlock(&reader->lock);
+}
+
+off_t reader_offset(const FileReader *reader) { return reader->position; }
+
+void reader_set_fragment_size(FileReader *reader, size_t size) {
+    if (reader->mapping != NULL) {
+        reader->fragment_size = size;
+        return;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->fragment_size = size;
+    pthread_mutex_unlock(&reader->lock);
+}
+
+void reader_destroy(FileReader *reader) {
+    if (reader->mapping != NULL) {
+        munmap(reader->mapping, reader->mapping_size);
+        free(reader);
+        return;
+    }
+
+    stop_threads(reader);
+    pthread_join(reader->thread, NULL);
+
+    pthread_cond_destroy(&reader->not_full);
+    pthread_cond_destroy(&reader->readable);
+    pthread_cond_destroy(&reader->not_empty);
+    pthread_mutex_destroy(&reader->lock);
+    free(reader);
+}
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+
+#include "application_layer/writer.h"
+#include "application_layer/checkpoint.h"
+#include "log.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/**
+ * @brief Writes a batch of fragments from a writer's ring with as few
+ *        syscalls as possible.
+ *
+ * @param writer The writer.
+ * @param first The index of the first fragment.
+ * @param n The number of fragments.
+ *
+ * @return -1 on error.
+ */
+int write_batch(FileWriter *writer, size_t first, size_t n) {
+    struct iovec iov[WRITE_BEHIND];
+
+    for (size_t i = 0; i < n; ++i) {
+        size_t slot = (first + i) % WRITE_BEHIND;
+        iov[i] = (struct iovec){.iov_base = writer->fragments[slot],
+                                .iov_len = writer->sizes[slot]};
+    }
+
+    struct iovec *next = iov;
+    int left = n;
+
+    while (left > 0) {
+        ssize_t written = pwritev(writer->fd, next, MIN(left, IOV_MAX),
+                                  writer->offset);
+
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+
+            ERROR("Writing to RX fd: %s\n", strerror(errno));
+            return -1;
+        }
+
+        writer->offset += written;
+        TRACE_EVENT(TRACE_FILE_WRITTEN, 0, written);
+
+        // Skip what was written, which may end in the middle of a fragment
+        for (; left > 0 && (size_t)written >= next->iov_len; ++next, --left)
+            written -= next->iov_len;
+
+        if (left > 0) {
+            next->iov_base = (uint8_t *)next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Flushes what a writer wrote to disk and records it in its
+ *        checkpoint.
+ *
+ * @note Failing to is only a warning, the transfer goes on.
+ *
+ * @param writer The writer.
+ */
+void save_checkpoint(FileWriter *writer) {
+    if (writer->checkpoint == NULL || writer->offset == writer->checkpointed)
+        return;
+
+    int result;
+
+    if (writer->mapping != NULL) {
+        // msync needs an address aligned to a page
+        long page = sysconf(_SC_PAGESIZE);
+        off_t from = writer->checkpointed / page * page;
+
+        result = msync(writer->mapping + from, writer->offset - from,
+                       MS_SYNC);
+    } else {
+        result = fdatasync(writer->fd);
+    }
+
+    if (result == -1 ||
+        checkpoint_write(writer->checkpoint, writer->offset) == -1) {
+        ALARM("Saving checkpoint %s: %s\n", writer->checkpoint,
+              strerror(errno));
+        return;
+    }
+
+    writer->checkpointed = writer->offset;
+}
+
+/**
+ * @brief Writes fragments from a writer's ring, in batches of #WRITE_BATCH,
+ *        until the writer is stopped and every fragment is written.
+ *
+ * @param arg The writer.
+ *
+ * @return NULL.
+ */
+void *writer_thread(void *arg) {
+    FileWriter *writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (true) {
+        while (writer->count < WRITE_BATCH && !writer->stop)
+            pthread_cond_wait(&writer->not_empty, &writer->lock);
+
+        if (writer->count == 0)
+            break;
+
+        size_t first = writer->head, n = writer->count;
+
+        // The fragments aren't reused until count is decremented
+        pthread_mutex_unlock(&writer->lock);
+        bool failed = !writer->failed && write_batch(writer, first, n) == -1;
+        pthread_mutex_lock(&writer->lock);
+
+        writer->failed |= failed;
+        writer->head = (writer->head + n) % WRITE_BEHIND;
+        writer->count -= n;
+        pthread_cond_signal(&writer->not_full);
+
+        // Only this thread writes, so the offset is stable while unlocked
+        if (!writer->failed &&
+            writer->offset - writer->checkpointed >= CHECKPOINT_INTERVAL) {
+            pthread_mutex_unlock(&writer->lock);
+            save_checkpoint(writer);
+            pthread_mutex_lock(&writer->lock);
+        }
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Sizes the file of a writer and maps it into memory.
+ *
+ * @param writer The writer.
+ * @param file_size The size of the file.
+ *
+ * @return -1 if the file can't be mapped, and must be written instead.
+ */
+int map_rx_file(FileWriter *writer, size_t file_size) {
+    if (file_size == 0)
+        return -1;
+
+    if (ftruncate(writer->fd, file_size) == -1) {
+        ALARM("Sizing RX file: %s\n", strerror(errno));
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         writer->fd, 0);
+
+    if (mapping == MAP_FAILED) {
+        ALARM("Mapping RX file: %s\n", strerror(errno));
+        ftruncate(writer->fd, 0);
+        return -1;
+    }
+
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+
+    writer->mapping = mapping;
+    writer->mapping_size = file_size;
+
+    return 0;
+}
+
+FileWriter *writer_create(int fd, off_t offset, size_t file_size,
+                          const char *checkpoint) {
+    FileWriter *writer = malloc(sizeof(FileWriter));
+
+    if (writer == NULL)
+        return NULL;
+
+    writer->fd = fd;
+    writer->mapping = NULL;
+    writer->offset = offset;
+    writer->checkpoint = checkpoint;
+    writer->checkpointed = offset;
+    writer->head = 0;
+    writer->count = 0;
+    writer->stop = false;
+    writer->failed = false;
+
+    if (MMAP && map_rx_file(writer, file_size) == 0)
+        return writer;
+
+    // Reserve the space up front, without changing the size of the file
+    if (file_size > (size_t)offset &&
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, file_size - offset) == -1 &&
+        errno != EOPNOTSUPP)
+        ALARM("Preallocating RX file: %s\n", strerror(errno));
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->not_empty, NULL);
+    pthread_cond_init(&writer->not_full, NULL);
+
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+        pthread_cond_destroy(&writer->not_full);
+        pthread_cond_destroy(&writer->not_empty);
+        pthread_mutex_destroy(&writer->lock);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+ssize_t writer_write(FileWriter *writer, const uint8_t *buf, size_t size) {
+    if (writer->mapping != NULL) {
+        if (writer->offset + size > writer->mapping_size) {
+            ERROR("Received more than the size of the file\n");
+            writer->failed = true;
+            return -1;
+        }
+
+        memcpy(writer->mapping + writer->offset, buf, size);
+        writer->offset += size;
+
+        if (writer->offset - writer->checkpointed >= CHECKPOINT_INTERVAL)
+            save_checkpoint(writer);
+
+        return size;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (writer->count == WRITE_BEHIND)
+        pthread_cond_wait(&writer->not_full, &writer->lock);
+
+    if (writer->failed) {
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+
+    size_t slot = (writer->head + writer->count) % WRITE_BEHIND;
+
+    // The slot isn't visible to the writer thread until count is incremented
+    pthread_mutex_unlock(&writer->lock);
+
+    memcpy(writer->fragments[slot], buf, size);
+    writer->sizes[slot] = size;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->count++;
+    if (writer->count >= WRITE_BATCH)
+        pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+
+    return size;
+}
+
+int writer_destroy(FileWriter *writer) {
+    if (writer->mapping != NULL) {
+        bool failed = writer->failed;
+
+        if (!failed)
+            save_checkpoint(writer);
+
+        munmap(writer->mapping, writer->mapping_size);
+
+        // Don't leave zeros where fragments weren't received
+        if ((size_t)writer->offset < writer->mapping_size &&
+            ftruncate(writer->fd, writer->offset) == -1)
+            failed = true;
+
+        free(writer);
+        return failed ? -1 : 0;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_signal(&writer->not_empty);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+
+    bool failed = writer->failed;
+
+    if (!failed)
+        save_checkpoint(writer);
+
+    pthread_cond_destroy(&writer->not_full);
+    pthread_cond_destroy(&writer->not_empty);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+
+    return failed ? -1 : 0;
+}
@@ -6,26 +6,44 @@
 #include <string.h>
 #include <sys/param.h>
 
-#define BUFFER 64
-
 /**
- * @brief Resizes a vector if its current capacity is too low.
+ * @brief Resizes a vector, if needed, so it can hold at least a given number
+ *        of bytes.
+ *
+ * The capacity is at least doubled, so that growing a vector byte by byte
+ * takes a logarithmic number of reallocations.
  *
  * @param this The vector to resize.
+ * @param capacity The minimum capacity.
  */
-void resize_if_needed(ByteVector *this) {
-    if (this->capacity < this->length) {
-        this->capacity = this->length + BUFFER;
-        this->array =
-            reallocarray(this->array, this->capacity, sizeof(uint8_t));
+void grow(ByteVector *this, size_t capacity) {
+    if (this->capacity >= capacity)
+        return;
+
+    capacity = MAX(capacity, 2 * this->capacity);
+
+    if (this->array == this->inline_array) {
+        this->array = malloc(capacity);
+        memcpy(this->array, this->inline_array, this->capacity);
+    } else {
+        this->array = reallocarray(this->array, capacity, sizeof(uint8_t));
     }
+
+    this->capacity = capacity;
 }
 
+/**
+ * @brief Resizes a vector if its current capacity is too low.
+ *
+ * @param this The vector to resize.
+ */
+void resize_if_needed(ByteVector *this) { grow(this, this->length); }
+
 ByteVector *bv_create() {
     ByteVector *v = malloc(sizeof(ByteVector));
     v->length = 0;
-    v->capacity = BUFFER;
-    v->array = calloc(v->capacity, sizeof(uint8_t));
+    v->capacity = BV_INLINE_CAPACITY;
+    v->array = v->inline_array;
     return v;
 }
 
@@ -33,10 +51,22 @@ void bv_destroy(ByteVector *this) {
     if (this == NULL)
         return;
 
-    free(this->array);
+    if (this->array != this->inline_array)
+        free(this->array);
     free(this);
 }
 
+void bv_clear(ByteVector *this) { this->length = 0; }
+
+void bv_reserve(ByteVector *this, size_t capacity) { grow(this, capacity); }
+
+uint8_t *bv_spare(ByteVector *this, size_t len) {
+    grow(this, this->length + len);
+    return this->array + this->length;
+}
+
+void bv_commit(ByteVector *this, size_t len) { this->length += len; }
+
 void bv_push(ByteVector *this, const uint8_t *buf, size_t buf_len) {
     size_t i = this->length;
     this->length += buf_len;
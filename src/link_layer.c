@@ -12,12 +12,18 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "link_layer.h"
+#include "link_layer/fec.h"
 #include "link_layer/frame.h"
+#include "link_layer/parser.h"
+#include "link_layer/pool.h"
 #include "link_layer/timer.h"
 #include "log.h"
+#include "options.h"
+#include "trace.h"
 
 // MISC
 #define _POSIX_SOURCE 1 // POSIX compliant source
@@ -31,20 +37,57 @@
  */
 int handshake(LLConnection *this) {
     if (this->role == LL_TX) {
-        if (send_frame(this, create_frame(this, SET)) == -1)
+        if (send_frame(this, create_frame(this, WITH_FCS(SET, this->fcs))) ==
+            -1)
             return -1;
 
         Frame *f = expect_frame(this, UA);
         if (f == NULL)
             return -1;
+
+        if (FCS_NR(f->command) < this->fcs)
+            this->fcs = FCS_NR(f->command);
         frame_destroy(f);
 
-        LOG("Handshake complete\n");
+        LOG("Handshake complete, using %s\n", fcs_name(this->fcs));
     }
 
     return 0;
 }
 
+/**
+ * @brief Converts a baudrate to the speed understood by termios.
+ *
+ * @param baudrate The baudrate, in bits per second.
+ *
+ * @return The speed.
+ * @return B0 if the baudrate isn't supported.
+ */
+speed_t baudrate_speed(unsigned int baudrate) {
+    switch (baudrate) {
+    case 1200:
+        return B1200;
+    case 2400:
+        return B2400;
+    case 4800:
+        return B4800;
+    case 9600:
+        return B9600;
+    case 19200:
+        return B19200;
+    case 38400:
+        return B38400;
+    case 57600:
+        return B57600;
+    case 115200:
+        return B115200;
+    case 230400:
+        return B230400;
+    default:
+        return B0;
+    }
+}
+
 /**
  * @brief Sets the up serial port.
  *
@@ -56,6 +99,13 @@ int handshake(LLConnection *this) {
 int setup_serial(LLConnection *this, const char *serial_port) {
     LOG("Setting up serial port connection...\n");
 
+    speed_t speed = baudrate_speed(this->baudrate);
+
+    if (speed == B0) {
+        ERROR("llopen: Unsupported baudrate %u\n", this->baudrate);
+        return -1;
+    }
+
     this->fd = open(serial_port, O_RDWR | O_NOCTTY);
 
     if (this->fd == -1) {
@@ -71,7 +121,7 @@ int setup_serial(LLConnection *this, const char *serial_port) {
     struct termios newtermios;
     memset(&newtermios, 0, sizeof(newtermios));
 
-    newtermios.c_cflag = BAUDRATE(C) | CS8 | CLOCAL | CREAD;
+    newtermios.c_cflag = speed | CS8 | CLOCAL | CREAD;
 
     newtermios.c_iflag = IGNPAR;
     newtermios.c_oflag = 0;
@@ -101,18 +151,48 @@ int setup_serial(LLConnection *this, const char *serial_port) {
  * @param this The connection.
  */
 void connection_destroy(LLConnection *this) {
+    timer_destroy(this);
     frame_destroy(this->last_command_frame);
+    parser_destroy(&this->parser);
+    for (int s = 0; s < SEQ_MODULO; ++s) {
+        frame_destroy(this->tx_window[s]);
+        if (this->rx_window[s] != &this->rx_target)
+            bv_destroy(this->rx_window[s]);
+        bv_destroy(this->rx_copies[s]);
+        bv_destroy(this->fec_groups[s].parity);
+    }
+    pool_destroy(&this->pool);
     tcsetattr(this->fd, TCSANOW, &this->old_termios);
     close(this->fd);
-    timer_destroy(this);
     free(this);
 }
 
 LLConnection *llopen(const char *serial_port, LLRole role) {
-    LLConnection *this = malloc(sizeof(LLConnection));
-    this->last_command_frame = NULL;
+    LLConnection *this = calloc(1, sizeof(LLConnection));
+
+    clock_gettime(CLOCK_MONOTONIC, &this->opened_at);
+    TRACE_EVENT(TRACE_PHASE, TRACE_OPENING, 0);
 
     this->role = role;
+    this->arq = ARQ_MODE(ARQ);
+    this->fcs = FCS_MODE(FCS);
+    this->window_size = WINDOW_SIZE;
+    this->rto = TIMEOUT * 1000;
+    this->baudrate = option("C", C);
+    this->fer = option("FER", FER);
+    this->t_prop = option("T_PROP", T_PROP);
+    this->fec = option("FEC", FEC);
+    this->fec_interleave = option("FEC_INTERLEAVE", FEC_INTERLEAVE);
+
+    // Larger windows would make new frames indistinguishable from old ones
+    if (this->arq == LL_SELECTIVE_REPEAT && this->window_size > SEQ_MODULO / 2)
+        this->window_size = SEQ_MODULO / 2;
+
+    fec_setup(this);
+
+    this->timer = -1;
+    this->read_timeout = -1;
+    init_control_frames(this);
 
     if (setup_serial(this, serial_port) == -1) {
         connection_destroy(this);
@@ -129,71 +209,304 @@ LLConnection *llopen(const char *serial_port, LLRole role) {
         return NULL;
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &this->established_at);
+    TRACE_EVENT(TRACE_PHASE, TRACE_ESTABLISHED, 0);
+
     return this;
 }
 
-ssize_t llwrite(LLConnection *this, const uint8_t *buf, size_t bufSize) {
-    if (this->closed)
+/**
+ * @brief Handles incoming frames until at most a given number of I frames are
+ *        awaiting acknowledgement, or the other side disconnects.
+ *
+ * @param this The connection.
+ * @param max_outstanding The number of unacknowledged frames to wait for.
+ *
+ * @return -1 on failure.
+ */
+int wait_acknowledgements(LLConnection *this, uint8_t max_outstanding) {
+    while (!this->closed &&
+           SEQ_DISTANCE(this->tx_base, this->tx_sequence_nr) >
+               max_outstanding) {
+        // Nothing is retransmitted anymore, so nothing would be acknowledged
+        if (this->failed) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        Frame *f = receive_frame(this);
+        if (f == NULL)
+            return -1;
+        frame_destroy(f);
+    }
+
+    return 0;
+}
+
+ssize_t llwritev(LLConnection *this, const struct iovec *iov, int iovcnt) {
+    if (this->closed) {
+        errno = ECONNRESET;
         return -1;
+    }
 
-    LOG("Creating I frame!\n");
+    if (this->failed) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
 
-    Frame *frame = create_frame(this, I(this->tx_sequence_nr));
+    if (poll_frames(this) == -1 ||
+        wait_acknowledgements(this, this->window_size - 1) == -1)
+        return -1;
 
-    if (frame == NULL)
+    // The receiver may have disconnected while we waited
+    if (this->closed) {
+        errno = ECONNRESET;
         return -1;
+    }
+
+    uint8_t s = this->tx_sequence_nr;
+    Frame *frame = create_frame(this, I(s));
 
-    frame->information = bv_create();
-    bv_push(frame->information, buf, bufSize);
+    if (frame == NULL)
+        return -1;
 
-    LOG("Sending frame I(%d)\n", this->tx_sequence_nr);
+    // Retransmissions only need the encoded frame, so the information is
+    // stuffed straight from the caller's buffer
+    encode_frame(this, frame, iov, iovcnt);
 
     ssize_t bytes_written = send_frame(this, frame);
 
-    if (bytes_written == -1)
-        return -1;
+    if (bytes_written > 0) {
+        size_t len = 0;
+        for (int i = 0; i < iovcnt; ++i)
+            len += iov[i].iov_len;
 
-    this->tx_sequence_nr = 1 - this->tx_sequence_nr;
+        this->stats.i_frames_sent++;
+        this->stats.payload_bytes_sent += len;
+        TRACE_EVENT(TRACE_LLWRITE, 0, len);
 
-    LOG("Expecting RR(%d)\n", this->tx_sequence_nr);
+        if (fec_sent(this, s, iov, iovcnt) == -1)
+            return -1;
+    }
 
-    Frame *f = expect_frame(this, RR(this->tx_sequence_nr));
-    if (f == NULL)
+    return bytes_written;
+}
+
+ssize_t llwrite(LLConnection *this, const uint8_t *buf, size_t bufSize) {
+    struct iovec iov = {.iov_base = (uint8_t *)buf, .iov_len = bufSize};
+
+    return llwritev(this, &iov, 1);
+}
+
+int llpending(LLConnection *this) {
+    return SEQ_DISTANCE(this->tx_base, this->tx_sequence_nr);
+}
+
+int llsync(LLConnection *this, unsigned int max_pending) {
+    if (wait_acknowledgements(this, max_pending) == -1)
         return -1;
-    frame_destroy(f);
 
-    return bytes_written;
+    // Stopped waiting because the receiver disconnected
+    if (llpending(this) > (int)max_pending) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    return 0;
 }
 
-ssize_t llread(LLConnection *this, uint8_t *packet) {
+/**
+ * @brief Handles incoming frames until the next I frame to be read arrives.
+ *
+ * @param this The connection.
+ *
+ * @return -1 on failure.
+ */
+int wait_information(LLConnection *this) {
+    // Frames are stored as they are handled, possibly out of order
+    while (this->rx_window[this->rx_read_nr] == NULL) {
+        Frame *f = receive_frame(this);
+        if (f == NULL)
+            return -1;
+        frame_destroy(f);
+
+        if (this->closed)
+            return -1;
+    }
+
+    return 0;
+}
+
+ssize_t llread_into(LLConnection *this, uint8_t *buf, size_t buf_size) {
     if (this->closed)
         return -1;
 
-    LOG("Waiting for I frame\n");
+    this->rx_target =
+        (ByteVector){.array = buf, .length = 0, .capacity = buf_size};
 
-    Frame *frame = expect_frame(this, I(this->rx_sequence_nr));
+    int result = wait_information(this);
 
-    if (frame == NULL)
-        return -1;
+    parser_release_target(this);
 
-    this->rx_sequence_nr = 1 - this->rx_sequence_nr;
+    if (result == -1)
+        return -1;
 
-    LOG("Reading I frame\n");
+    ByteVector *information = this->rx_window[this->rx_read_nr];
+    this->rx_window[this->rx_read_nr] = NULL;
+    this->rx_read_nr = SEQ_NEXT(this->rx_read_nr);
 
-    memcpy(packet, frame->information->array, frame->information->length);
+    ssize_t bytes_read = information->length;
 
-    LOG("Read I frame with size %lu\n", frame->information->length);
+    // Otherwise the frame arrived before the call, or didn't fit
+    if (information != &this->rx_target) {
+        if (information->length > buf_size) {
+            ERROR("I frame with size %lu doesn't fit in %lu bytes\n",
+                  information->length, buf_size);
+            bytes_read = -1;
+        } else {
+            memcpy(buf, information->array, information->length);
+        }
 
-    int bytes_read = frame->information->length;
+        pool_put_vector(&this->pool, information);
+    }
 
-    frame_destroy(frame);
+    TRACE_EVENT(TRACE_LLREAD, 0, bytes_read);
 
     return bytes_read;
 }
 
-int llclose(LLConnection *this) {
+double llerror_rate(LLConnection *this) { return this->fer_estimate; }
+
+/**
+ * @brief Computes the time between two instants.
+ *
+ * @param from The first instant.
+ * @param to The second instant.
+ *
+ * @return The time between them, in nanoseconds.
+ */
+uint64_t elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000 +
+           (to->tv_nsec - from->tv_nsec);
+}
+
+LLStats llstats(LLConnection *this) {
+    LLStats stats = this->stats;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    bool closing =
+        this->closing_at.tv_sec != 0 || this->closing_at.tv_nsec != 0;
+
+    stats.handshake_ns = elapsed_ns(&this->opened_at, &this->established_at);
+    stats.transfer_ns = elapsed_ns(&this->established_at,
+                                   closing ? &this->closing_at : &now);
+    stats.teardown_ns = closing ? elapsed_ns(&this->closing_at, &now) : 0;
+    stats.frame_allocations = this->pool.frame_allocations;
+    stats.vector_allocations = this->pool.vector_allocations;
+
+    return stats;
+}
+
+/**
+ * @brief Prints the statistics of a connection as text.
+ *
+ * @param stats The statistics.
+ */
+void print_stats_text(const LLStats *stats) {
+    double overhead = stats->payload_bytes_sent == 0
+                          ? 0
+                          : (double)stats->wire_bytes_sent /
+                                    stats->payload_bytes_sent -
+                                1;
+
+    printf("I frames sent: %lu\n", stats->i_frames_sent);
+    printf("I frames received: %lu\n", stats->i_frames_received);
+    printf("Retransmissions: %lu\n", stats->retransmissions);
+    printf("Timeouts: %lu\n", stats->timeouts);
+    printf("REJ sent/received: %lu/%lu\n", stats->rej_sent,
+           stats->rej_received);
+    printf("SREJ sent/received: %lu/%lu\n", stats->srej_sent,
+           stats->srej_received);
+    printf("Duplicate I frames: %lu\n", stats->duplicates);
+    printf("Damaged I frames: %lu\n", stats->damaged);
+    printf("Parity frames sent: %lu\n", stats->parity_sent);
+    printf("I frames recovered: %lu\n", stats->recovered);
+    printf("Frames/vectors allocated: %lu/%lu\n", stats->frame_allocations,
+           stats->vector_allocations);
+    printf("Payload bytes sent/received: %lu/%lu\n",
+           stats->payload_bytes_sent, stats->payload_bytes_received);
+    printf("Wire bytes sent/received: %lu/%lu\n", stats->wire_bytes_sent,
+           stats->wire_bytes_received);
+    printf("Overhead of bytes sent: %.2f%%\n", overhead * 100);
+    printf("Handshake: %.3fms\n", stats->handshake_ns / 1e6);
+    printf("Transfer: %.3fms\n", stats->transfer_ns / 1e6);
+    printf("Teardown: %.3fms\n", stats->teardown_ns / 1e6);
+}
+
+/**
+ * @brief Prints the statistics of a connection as a JSON object, in a single
+ *        line.
+ *
+ * @param stats The statistics.
+ */
+void print_stats_json(const LLStats *stats) {
+    printf("{\"i_frames_sent\":%lu,\"i_frames_received\":%lu,"
+           "\"retransmissions\":%lu,\"timeouts\":%lu,\"rej_sent\":%lu,"
+           "\"rej_received\":%lu,\"srej_sent\":%lu,\"srej_received\":%lu,"
+           "\"duplicates\":%lu,\"damaged\":%lu,\"parity_sent\":%lu,"
+           "\"recovered\":%lu,\"frame_allocations\":%lu,"
+           "\"vector_allocations\":%lu,\"payload_bytes_sent\":%lu,"
+           "\"wire_bytes_sent\":%lu,\"payload_bytes_received\":%lu,"
+           "\"wire_bytes_received\":%lu,\"handshake_ns\":%lu,"
+           "\"transfer_ns\":%lu,\"teardown_ns\":%lu}\n",
+           stats->i_frames_sent, stats->i_frames_received,
+           stats->retransmissions, stats->timeouts, stats->rej_sent,
+           stats->rej_received, stats->srej_sent, stats->srej_received,
+           stats->duplicates, stats->damaged, stats->parity_sent,
+           stats->recovered, stats->frame_allocations,
+           stats->vector_allocations, stats->payload_bytes_sent,
+           stats->wire_bytes_sent, stats->payload_bytes_received,
+           stats->wire_bytes_received, stats->handshake_ns,
+           stats->transfer_ns, stats->teardown_ns);
+}
+
+void llset_read_timeout(LLConnection *this, int timeout) {
+    this->read_timeout = timeout;
+}
+
+int lldisconnect(LLConnection *this) {
+    if (this->closed)
+        return 0;
+
+    mark_closing(this);
+
+    if (send_frame(this, create_frame(this, DISC)) == -1)
+        return -1;
+
+    Frame *f = expect_frame(this, UA);
+    this->closed = true;
+
+    if (f == NULL)
+        return -1;
+
+    frame_destroy(f);
+
+    return 0;
+}
+
+int llclose(LLConnection *this, LLStatsFormat show_stats) {
     if (!this->closed) {
+        mark_closing(this);
+
         if (this->role == LL_TX) {
+            // The window can't drain once the receiver stopped answering,
+            // but the DISC is still retried like any other command frame
+            if (!this->failed) {
+                fec_flush(this);
+                wait_acknowledgements(this, 0);
+            }
+
             send_frame(this, create_frame(this, DISC));
             frame_destroy(expect_frame(this, DISC));
         } else {
@@ -201,7 +514,18 @@ int llclose(LLConnection *this) {
         }
     }
 
+    LOG("Allocated %lu frames and %lu vectors\n", this->pool.frame_allocations,
+        this->pool.vector_allocations);
+
+    LLStats stats = llstats(this);
+
+    if (show_stats == LL_STATS_TEXT)
+        print_stats_text(&stats);
+    else if (show_stats == LL_STATS_JSON)
+        print_stats_json(&stats);
+
     connection_destroy(this);
+    TRACE_EVENT(TRACE_PHASE, TRACE_CLOSED, 0);
 
     LOG("Closing serial port connection\n");
 
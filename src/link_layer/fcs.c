@@ -0,0 +1,291 @@
+#include "link_layer/fcs.h"
+
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+/**
+ * @brief The reflected polynomial of CRC-16-CCITT.
+ */
+#define CRC16_POLY 0x8408
+/**
+ * @brief The remainder of a CRC-16-CCITT over a message followed by its
+ *        complemented CRC.
+ */
+#define CRC16_RESIDUE 0xf0b8
+/**
+ * @brief The reflected polynomial of CRC-32.
+ */
+#define CRC32_POLY 0xedb88320
+/**
+ * @brief The remainder of a CRC-32 over a message followed by its
+ *        complemented CRC.
+ */
+#define CRC32_RESIDUE 0xdebb20e3
+
+/**
+ * @brief The slicing-by-8 tables of each CRC.
+ *
+ * Entry [k][b] is the CRC of byte b followed by k zero bytes.
+ */
+static uint32_t crc16_tables[8][256], crc32_tables[8][256];
+
+/**
+ * @brief Whether the CPU supports PCLMULQDQ.
+ */
+static bool has_pclmul;
+
+/**
+ * @brief Makes the tables be filled only once, even if connections are used
+ *        from several threads.
+ */
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Fills the slicing-by-8 tables of a reflected CRC.
+ *
+ * @param tables The tables.
+ * @param poly The reflected polynomial.
+ */
+void init_tables(uint32_t tables[8][256], uint32_t poly) {
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+
+        for (int i = 0; i < 8; ++i)
+            crc = crc & 1 ? (crc >> 1) ^ poly : crc >> 1;
+
+        tables[0][b] = crc;
+    }
+
+    for (int k = 1; k < 8; ++k)
+        for (int b = 0; b < 256; ++b)
+            tables[k][b] = (tables[k - 1][b] >> 8) ^
+                           tables[0][tables[k - 1][b] & 0xff];
+}
+
+/**
+ * @brief Reads 4 little endian bytes.
+ */
+static inline uint32_t load_le32(const uint8_t *buf) {
+    return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 | (uint32_t)buf[2] << 16 |
+           (uint32_t)buf[3] << 24;
+}
+
+/**
+ * @brief Updates a reflected CRC of at most 32 bits, 8 bytes at a time.
+ *
+ * @param tables The slicing-by-8 tables of the CRC.
+ * @param crc The current CRC.
+ * @param buf The bytes.
+ * @param len The number of bytes.
+ *
+ * @return The updated CRC.
+ */
+uint32_t crc_slice8(uint32_t tables[8][256], uint32_t crc, const uint8_t *buf,
+                    size_t len) {
+    for (; len >= 8; buf += 8, len -= 8) {
+        uint32_t lo = crc ^ load_le32(buf);
+        uint32_t hi = load_le32(buf + 4);
+
+        crc = tables[7][lo & 0xff] ^ tables[6][(lo >> 8) & 0xff] ^
+              tables[5][(lo >> 16) & 0xff] ^ tables[4][lo >> 24] ^
+              tables[3][hi & 0xff] ^ tables[2][(hi >> 8) & 0xff] ^
+              tables[1][(hi >> 16) & 0xff] ^ tables[0][hi >> 24];
+    }
+
+    for (; len > 0; ++buf, --len)
+        crc = tables[0][(crc ^ *buf) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * @brief Updates a CRC-32 by folding 64 bytes at a time with carry-less
+ *        multiplications, then reducing it with Barrett's method.
+ *
+ * See Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction", the constants are the ones for the reflected polynomial.
+ *
+ * @param crc The current CRC.
+ * @param buf The bytes.
+ * @param len The number of bytes, a multiple of 16 and at least 64.
+ *
+ * @return The updated CRC.
+ */
+__attribute__((target("pclmul,sse4.1"))) uint32_t
+crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+    for (buf += 64, len -= 64; len >= 64; buf += 64, len -= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+    }
+
+    // Fold the 4 lanes, and any 16 byte blocks left, into one
+    __m128i lanes[3] = {x2, x3, x4};
+    for (int i = 0; i < 3; ++i) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), x5);
+    }
+
+    for (; len >= 16; buf += 16, len -= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(
+                                                 (const __m128i *)buf)),
+                           x5);
+    }
+
+    // Fold 128 bits into 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduce 64 bits into 32
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+#endif
+
+/**
+ * @brief Fills the tables of every CRC and detects the CPU's features.
+ */
+void init_fcs_tables(void) {
+    init_tables(crc16_tables, CRC16_POLY);
+    init_tables(crc32_tables, CRC32_POLY);
+#ifdef HAVE_X86_SIMD
+    has_pclmul =
+        __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+void fcs_init(Fcs *fcs, LLFcsMode mode) {
+    pthread_once(&tables_once, init_fcs_tables);
+
+    fcs->mode = mode;
+
+    switch (mode) {
+    case LL_BCC:
+        fcs->value = 0;
+        break;
+    case LL_CRC16:
+        fcs->value = 0xffff;
+        break;
+    case LL_CRC32:
+        fcs->value = 0xffffffff;
+        break;
+    }
+}
+
+void fcs_update(Fcs *fcs, const uint8_t *buf, size_t len) {
+    switch (fcs->mode) {
+    case LL_BCC:
+        for (size_t i = 0; i < len; ++i)
+            fcs->value ^= buf[i];
+        break;
+
+    case LL_CRC16:
+        fcs->value = crc_slice8(crc16_tables, fcs->value, buf, len);
+        break;
+
+    case LL_CRC32:
+#ifdef HAVE_X86_SIMD
+        if (has_pclmul && len >= 64) {
+            size_t n = len & ~(size_t)15;
+            fcs->value = crc32_pclmul(fcs->value, buf, n);
+            buf += n;
+            len -= n;
+        }
+#endif
+        fcs->value = crc_slice8(crc32_tables, fcs->value, buf, len);
+        break;
+    }
+}
+
+size_t fcs_size(LLFcsMode mode) {
+    switch (mode) {
+    case LL_CRC16:
+        return 2;
+    case LL_CRC32:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+size_t fcs_final(const Fcs *fcs, uint8_t *dst) {
+    // CRCs are sent complemented, least significant byte first
+    uint32_t value = fcs->mode == LL_BCC ? fcs->value : ~fcs->value;
+    size_t size = fcs_size(fcs->mode);
+
+    for (size_t i = 0; i < size; ++i)
+        dst[i] = (uint8_t)(value >> (8 * i));
+
+    return size;
+}
+
+bool fcs_check(const Fcs *fcs) {
+    switch (fcs->mode) {
+    case LL_CRC16:
+        return fcs->value == CRC16_RESIDUE;
+    case LL_CRC32:
+        return fcs->value == CRC32_RESIDUE;
+    default:
+        // The BCC is XORed with the information, leaving 0 if they match
+        return fcs->value == 0;
+    }
+}
+
+const char *fcs_name(LLFcsMode mode) {
+    switch (mode) {
+    case LL_CRC16:
+        return "CRC-16";
+    case LL_CRC32:
+        return "CRC-32";
+    default:
+        return "BCC";
+    }
+}
@@ -0,0 +1,184 @@
+#include "link_layer/fec.h"
+#include "link_layer.h"
+#include "link_layer/frame.h"
+#include "log.h"
+
+#include <string.h>
+
+void fec_setup(LLConnection *connection) {
+    if (connection->fec == 0)
+        return;
+
+    // Damaged frames are only rebuilt if the ones after them are kept
+    if (connection->arq != LL_SELECTIVE_REPEAT) {
+        ALARM("FEC needs selective repeat, disabling it\n");
+        connection->fec = 0;
+        return;
+    }
+
+    if (connection->fec_interleave < 1)
+        connection->fec_interleave = 1;
+    if (connection->fec_interleave > connection->window_size)
+        connection->fec_interleave = connection->window_size;
+
+    // Every frame of a group must still be in the window when its parity
+    // arrives
+    unsigned int max_fec =
+        (connection->window_size - 1) / connection->fec_interleave + 1;
+
+    if (connection->fec > max_fec) {
+        ALARM("FEC groups of %u frames don't fit in the window, using %u\n",
+              connection->fec, max_fec);
+        connection->fec = max_fec;
+    }
+}
+
+void fec_add(ByteVector *parity, const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+
+    for (int i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+
+    if (parity->length < FEC_LENGTH_SIZE + len) {
+        size_t extra = FEC_LENGTH_SIZE + len - parity->length;
+
+        memset(bv_spare(parity, extra), 0, extra);
+        bv_commit(parity, extra);
+    }
+
+    parity->array[0] ^= len & 0xff;
+    parity->array[1] ^= len >> 8;
+
+    uint8_t *dst = parity->array + FEC_LENGTH_SIZE;
+
+    for (int i = 0; i < iovcnt; ++i) {
+        const uint8_t *src = iov[i].iov_base;
+
+        for (size_t j = 0; j < iov[i].iov_len; ++j)
+            dst[j] ^= src[j];
+
+        dst += iov[i].iov_len;
+    }
+}
+
+/**
+ * @brief Sends the #PARITY frame of a group and empties it.
+ *
+ * Parity frames are never retransmitted nor acknowledged, a lost one just
+ * means its group falls back to #SREJ.
+ *
+ * @param connection The connection.
+ * @param group The group.
+ *
+ * @return -1 on error.
+ */
+int send_parity(LLConnection *connection, FecGroup *group) {
+    Frame *frame = create_frame(connection, PARITY(group->first));
+
+    if (frame == NULL)
+        return -1;
+
+    uint8_t header[FEC_HEADER_SIZE] = {group->count,
+                                       connection->fec_interleave};
+    struct iovec iov[] = {
+        {.iov_base = header, .iov_len = sizeof(header)},
+        {.iov_base = group->parity->array, .iov_len = group->parity->length},
+    };
+
+    encode_frame(connection, frame, iov, 2);
+    frame->retransmitted = false;
+
+    ssize_t bytes_written = write_frame(connection, frame);
+    frame_destroy(frame);
+
+    bv_clear(group->parity);
+    group->count = 0;
+
+    if (bytes_written <= 0)
+        return -1;
+
+    connection->stats.parity_sent++;
+
+    return 0;
+}
+
+int fec_sent(LLConnection *connection, uint8_t s, const struct iovec *iov,
+             int iovcnt) {
+    if (connection->fec == 0)
+        return 0;
+
+    FecGroup *group = &connection->fec_groups[connection->fec_next];
+    connection->fec_next =
+        (connection->fec_next + 1) % connection->fec_interleave;
+
+    if (group->parity == NULL)
+        group->parity = bv_create();
+    if (group->count == 0)
+        group->first = s;
+
+    fec_add(group->parity, iov, iovcnt);
+
+    if (++group->count < connection->fec)
+        return 0;
+
+    return send_parity(connection, group);
+}
+
+int fec_flush(LLConnection *connection) {
+    if (connection->fec == 0)
+        return 0;
+
+    // In the order their first frames were sent
+    for (unsigned int i = 0; i < connection->fec_interleave; ++i) {
+        FecGroup *group =
+            &connection->fec_groups[(connection->fec_next + i) %
+                                    connection->fec_interleave];
+
+        if (group->count > 0 && send_parity(connection, group) == -1)
+            return -1;
+    }
+
+    connection->fec_next = 0;
+
+    return 0;
+}
+
+void fec_keep(LLConnection *connection, uint8_t s,
+              const ByteVector *information) {
+    if (connection->rx_copies[s] == NULL)
+        connection->rx_copies[s] = bv_create();
+    else
+        bv_clear(connection->rx_copies[s]);
+
+    bv_push(connection->rx_copies[s], information->array,
+            information->length);
+}
+
+ssize_t fec_recover(ByteVector *parity) {
+    if (parity->length < FEC_LENGTH_SIZE)
+        return -1;
+
+    size_t len = parity->array[0] | parity->array[1] << 8;
+    size_t padded = parity->length - FEC_LENGTH_SIZE;
+
+    if (len > padded)
+        return -1;
+
+    // The missing frame was padded with zeros, so anything else means the
+    // group was mixed up
+    for (size_t i = len; i < padded; ++i)
+        if (parity->array[FEC_LENGTH_SIZE + i] != 0)
+            return -1;
+
+    memmove(parity->array, parity->array + FEC_LENGTH_SIZE, len);
+    parity->length = len;
+
+    return len;
+}
+
+uint8_t fec_span(LLConnection *connection) {
+    if (connection->fec == 0)
+        return 0;
+
+    return (connection->fec - 1) * connection->fec_interleave + 1;
+}
@@ -1,63 +1,22 @@
 #include "link_layer/frame.h"
 #include "link_layer.h"
+#include "link_layer/fec.h"
+#include "link_layer/parser.h"
+#include "link_layer/stuffing.h"
 #include "link_layer/timer.h"
 #include "log.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <string.h>
+#include <sys/param.h>
 #include <time.h>
 #include <unistd.h>
 
-/**
- * @brief An enum representing the valid states in the state machine for reading
- *        a frame.
- */
-typedef enum {
-    /**
-     * @brief The starting state.
-     */
-    START,
-    /**
-     * @brief The state after the first #FLAG was read.
-     */
-    FLAG_RCV,
-    /**
-     * @brief The state after the address was read.
-     */
-    A_RCV,
-    /**
-     * @brief The state after the command was read.
-     */
-    C_RCV,
-    /**
-     * @brief The state after the bcc was read and verified.
-     */
-    BCC_RCV,
-    /**
-     * @brief The state after some data in an I frame was read.
-     */
-    DATA_RCV,
-    /**
-     * @brief The state after an #ESC byte was read.
-     */
-    ESC_RCV,
-    /**
-     * @brief The state after the last #FLAG was received.
-     */
-    END_FLAG_RCV,
-    /**
-     * @brief The last state, means the state machine accepted the frame.
-     */
-    END,
-    /**
-     * @brief The error state, means there was an error in the body of an I
-     *        frame.
-     */
-    NACK,
-} ReadFrameState;
-
 Frame *create_frame(LLConnection *connection, uint8_t cmd) {
-    Frame *frame = malloc(sizeof(Frame));
+    Frame *frame = pool_get_frame(&connection->pool);
 
     if (frame == NULL)
         return NULL;
@@ -71,26 +30,10 @@ Frame *create_frame(LLConnection *connection, uint8_t cmd) {
     return frame;
 }
 
-/**
- * @brief Constructs the BCC byte for a given frame.
- *
- * @param frame The frame.
- *
- * @return The BCC byte.
- */
 uint8_t make_bcc(Frame *frame) {
     return (uint8_t)(frame->address ^ frame->command);
 }
 
-/**
- * @brief Checks if a frame's address and command combination can be handled by
- *        this layer's role.
- *
- * @param frame The frame.
- * @param role This layer's role
- *
- * @return Whether the frame's address and command combination is legal.
- */
 bool check_command_and_address(Frame *frame, LLRole role) {
     return (IS_COMMAND(frame->command) &&
             ((role == LL_RX && frame->address == TX_ADDR) ||
@@ -100,259 +43,656 @@ bool check_command_and_address(Frame *frame, LLRole role) {
              (role == LL_TX && frame->address == TX_ADDR)));
 }
 
+int wait_events(LLConnection *connection, int timeout) {
+    struct pollfd fds[] = {
+        {.fd = connection->fd, .events = POLLIN},
+        {.fd = connection->timer, .events = POLLIN},
+    };
+
+    int ready = poll(fds, 2, timeout);
+
+    if (ready == -1)
+        return errno == EINTR ? 1 : -1;
+
+    if (ready == 0)
+        return 0;
+
+    if (fds[1].revents & POLLIN) {
+        uint64_t expirations;
+
+        if (read(connection->timer, &expirations, sizeof(expirations)) > 0 &&
+            timer_expired(connection) == -1)
+            return -1;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t bytes_read =
+            read(connection->fd, connection->rx_buffer, RX_BUFFER_SIZE);
+
+        if (bytes_read <= 0)
+            return -1;
+
+        connection->stats.wire_bytes_received += bytes_read;
+        TRACE_EVENT(TRACE_BYTES_READ, 0, bytes_read);
+        parse_frames(connection, connection->rx_buffer, bytes_read);
+    }
+
+    return 1;
+}
+
+Frame *read_frame(LLConnection *connection) {
+    Frame *frame;
+
+    while ((frame = parser_take(connection)) == NULL) {
+        int result = wait_events(connection, connection->read_timeout);
+
+        if (result == -1)
+            return NULL;
+
+        // Unless a frame awaits acknowledgement, retransmitted until N_TRIES
+        if (result == 0 && !timer_armed(connection)) {
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+    }
+
+    usleep(connection->t_prop);
+    return frame;
+}
+
 /**
- * @return A pseudo-random number between 0 and 1.
+ * @brief Writes byte stuffed information, gathered from several buffers,
+ *        followed by its frame check sequence, into a buffer.
+ *
+ * @param buf Where to write the information.
+ * @param iov The buffers of the information.
+ * @param iovcnt The number of buffers.
+ * @param len The total length of the information.
+ * @param mode The frame check sequence to use.
  */
-double rand_double() { return (double)rand() / (double)RAND_MAX; }
+void write_info(ByteVector *buf, const struct iovec *iov, int iovcnt,
+                size_t len, LLFcsMode mode) {
+    Fcs fcs;
+    fcs_init(&fcs, mode);
 
-Frame *read_frame(LLConnection *connection) {
-    ReadFrameState state = START;
-    Frame *frame = malloc(sizeof(Frame));
-    frame->information = NULL;
+    uint8_t check[FCS_MAX_SIZE];
+    size_t check_size = fcs_size(mode);
 
-    if (frame == NULL)
-        return NULL;
+    // Every byte, including the check, may need to be escaped
+    uint8_t *dst = bv_spare(buf, 2 * (len + check_size));
 
-    uint8_t temp;
+    size_t stuffed = 0;
 
-    while (true) {
-        switch (state) {
-        case START:
-            if (read(connection->fd, &temp, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+    for (int i = 0; i < iovcnt; ++i)
+        stuffed += stuff_bytes(dst + stuffed, iov[i].iov_base,
+                               iov[i].iov_len, &fcs);
 
-            if (temp == FLAG)
-                state = FLAG_RCV;
+    fcs_final(&fcs, check);
+    stuffed += stuff_bytes(dst + stuffed, check, check_size, NULL);
 
-            break;
+    bv_commit(buf, stuffed);
+}
 
-        case FLAG_RCV:
-            if (read(connection->fd, &frame->address, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+void encode_frame(LLConnection *connection, Frame *frame,
+                  const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
 
-            if (frame->address == RX_ADDR || frame->address == TX_ADDR)
-                state = A_RCV;
-            else if (frame->address == FLAG)
-                state = FLAG_RCV;
-            else
-                state = START;
+    for (int i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
 
-            break;
+    ByteVector *buf = pool_get_vector(&connection->pool);
+    bv_reserve(buf,
+               2 * (len + fcs_size(connection->fcs)) + CONTROL_FRAME_SIZE);
 
-        case A_RCV:
-            if (read(connection->fd, &frame->command, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+    bv_pushb(buf, FLAG);
+    bv_pushb(buf, frame->address);
+    bv_pushb(buf, frame->command);
+    bv_pushb(buf, make_bcc(frame));
 
-            if (check_command_and_address(frame, connection->role))
-                state = C_RCV;
-            else if (frame->command == FLAG)
-                state = FLAG_RCV;
-            else
-                state = START;
+    write_info(buf, iov, iovcnt, len, connection->fcs);
 
-            break;
+    bv_pushb(buf, FLAG);
 
-        case C_RCV:
-            if (read(connection->fd, &temp, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+    frame->encoded = buf;
+}
 
-            if (temp == make_bcc(frame) && rand_double() >= FER)
-                state = BCC_RCV;
-            else if (temp == FLAG)
-                state = FLAG_RCV;
-            else
-                state = START;
+ssize_t write_frame(LLConnection *connection, Frame *frame) {
+    if (frame == NULL)
+        return -1;
 
-            break;
+    if (frame->encoded == NULL && FRAME_TYPE(frame->command) == I(0) &&
+        frame->information != NULL) {
+        struct iovec iov = {.iov_base = frame->information->array,
+                            .iov_len = frame->information->length};
+        encode_frame(connection, frame, &iov, 1);
+    }
 
-        case BCC_RCV:
-            if ((frame->command & 0xF) == I(0)) {
-                state = DATA_RCV;
-            } else {
-                if (read(connection->fd, &temp, 1) != 1) {
-                    frame_destroy(frame);
-                    return NULL;
-                }
-
-                if (temp == FLAG)
-                    state = END;
-                else
-                    state = START;
-            }
-            break;
+    ssize_t bytes_written;
+
+    // Retransmissions write the bytes encoded the first time
+    if (frame->encoded != NULL)
+        bytes_written = write(connection->fd, frame->encoded->array,
+                              frame->encoded->length);
+    else
+        bytes_written =
+            write(connection->fd, connection->control_frames[frame->command],
+                  CONTROL_FRAME_SIZE);
+
+    if (bytes_written > 0) {
+        connection->stats.wire_bytes_sent += bytes_written;
+        TRACE_EVENT(frame->retransmitted ? TRACE_FRAME_RESENT
+                                         : TRACE_FRAME_SENT,
+                    frame->command, bytes_written);
+    }
 
-        case DATA_RCV:
-            if (frame->information == NULL)
-                frame->information = bv_create();
+    return bytes_written;
+}
 
-            if (read(connection->fd, &temp, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+void init_control_frames(LLConnection *connection) {
+    for (int c = 0; c < 256; ++c) {
+        Frame frame = {.command = c};
+        frame.address = (IS_COMMAND(c) && connection->role == LL_RX) ||
+                                (IS_RESPONSE(c) && connection->role == LL_TX)
+                            ? RX_ADDR
+                            : TX_ADDR;
+
+        uint8_t *buf = connection->control_frames[c];
+        buf[0] = FLAG;
+        buf[1] = frame.address;
+        buf[2] = frame.command;
+        buf[3] = make_bcc(&frame);
+        buf[4] = FLAG;
+    }
+}
 
-            if (temp == ESC)
-                state = ESC_RCV;
-            else if (temp == FLAG)
-                state = END_FLAG_RCV;
-            else
-                bv_pushb(frame->information, temp);
+void frame_destroy(Frame *this) {
+    if (this == NULL)
+        return;
 
-            break;
+    if (this->pool != NULL) {
+        pool_put_frame(this->pool, this);
+        return;
+    }
 
-        case ESC_RCV:
-            if (read(connection->fd, &temp, 1) != 1) {
-                frame_destroy(frame);
-                return NULL;
-            }
+    if (this->information != NULL)
+        bv_destroy(this->information);
+    if (this->encoded != NULL)
+        bv_destroy(this->encoded);
 
-            state = DATA_RCV;
+    free(this);
+}
 
-            if (temp == ESC_ESC)
-                bv_pushb(frame->information, ESC);
-            else if (temp == ESC_FLAG)
-                bv_pushb(frame->information, FLAG);
-            else
-                state = NACK;
+ssize_t send_frame(LLConnection *connection, Frame *frame) {
+    if (frame != NULL)
+        frame->retransmitted = false;
 
-            break;
+    ssize_t bytes_written = write_frame(connection, frame);
 
-        case NACK:
-            frame->command |= I_ERR;
-            state = END;
-            break;
+    if (bytes_written <= 0) {
+        frame_destroy(frame);
+        return -1;
+    }
 
-        case END_FLAG_RCV: {
-            uint8_t expected_bcc2 = 0;
-            uint8_t received_bcc2 = bv_popb(frame->information);
+    clock_gettime(CLOCK_MONOTONIC, &frame->sent_at);
 
-            if (rand_double() < FER)
-                received_bcc2 ^= 1;
+    if (FRAME_TYPE(frame->command) == I(0)) {
+        connection->fer_estimate *= 1 - FER_GAIN;
 
-            for (size_t j = 0; j <= frame->information->length; ++j)
-                expected_bcc2 ^= bv_get(frame->information, j);
+        bool window_empty = connection->tx_base == connection->tx_sequence_nr;
+        uint8_t s = SEQ_NR(frame->command);
 
-            if (expected_bcc2 != received_bcc2)
-                state = NACK;
-            else
-                state = END;
-            break;
-        }
+        frame_destroy(connection->tx_window[s]);
+        connection->tx_window[s] = frame;
+        connection->tx_sequence_nr = SEQ_NEXT(s);
+
+        if (window_empty) {
+            timer_reset_tries(connection);
 
-        default:
-            usleep(T_PROP);
-            return frame;
+            if (timer_arm(connection) == -1)
+                return -1;
         }
+    } else if (IS_COMMAND(frame->command)) {
+        frame_destroy(connection->last_command_frame);
+        connection->last_command_frame = frame;
+        timer_reset_tries(connection);
+
+        if (timer_arm(connection) == -1)
+            return -1;
+    } else {
+        frame_destroy(frame);
     }
+
+    return bytes_written;
+}
+
+void count_frame_error(LLConnection *connection) {
+    connection->fer_estimate = MIN(1, connection->fer_estimate + FER_GAIN);
+}
+
+void mark_closing(LLConnection *connection) {
+    if (connection->closing_at.tv_sec == 0 &&
+        connection->closing_at.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &connection->closing_at);
+        TRACE_EVENT(TRACE_PHASE, TRACE_CLOSING, 0);
+    }
+}
+
+ssize_t send_response(LLConnection *connection, uint8_t command) {
+    if (write(connection->fd, connection->control_frames[command],
+              CONTROL_FRAME_SIZE) != CONTROL_FRAME_SIZE)
+        return -1;
+
+    connection->stats.wire_bytes_sent += CONTROL_FRAME_SIZE;
+    TRACE_EVENT(TRACE_FRAME_SENT, command, CONTROL_FRAME_SIZE);
+
+    switch (FRAME_TYPE(command)) {
+    case REJ(0):
+        connection->stats.rej_sent++;
+        break;
+    case SREJ(0):
+        connection->stats.srej_sent++;
+        break;
+    }
+
+    return CONTROL_FRAME_SIZE;
 }
 
 /**
- * @brief Writes the byte stuffed information from an I frame into a buffer.
+ * @brief Acknowledges every I frame sent before a given sequence number.
  *
- * @param buf Where to write the information.
- * @param frame The frame.
+ * Frees the acknowledged frames and slides the transmission window forward,
+ * restarting the retransmission timer if there are still frames awaiting
+ * acknowledgement.
+ *
+ * @param connection The connection.
+ * @param r The sequence number of the next frame the receiver expects.
+ *
+ * @return -1 on error.
  */
-void write_info(ByteVector *buf, Frame *frame) {
-    uint8_t bcc = 0, temp;
-
-    for (size_t i = 0; i < frame->information->length; ++i) {
-        temp = bv_get(frame->information, i);
-        bcc ^= temp;
-
-        if (temp == FLAG) {
-            bv_pushb(buf, ESC);
-            bv_pushb(buf, ESC_FLAG);
-        } else if (temp == ESC) {
-            bv_pushb(buf, ESC);
-            bv_pushb(buf, ESC_ESC);
-        } else {
-            bv_pushb(buf, temp);
-        }
+int acknowledge(LLConnection *connection, uint8_t r) {
+    uint8_t acked = SEQ_DISTANCE(connection->tx_base, r);
+
+    if (acked == 0 ||
+        acked > SEQ_DISTANCE(connection->tx_base, connection->tx_sequence_nr))
+        return 0;
+
+    // The newest frame acknowledged gives the most recent round trip time,
+    // unless it was held back behind one that had to be retransmitted
+    Frame *newest = connection->tx_window[SEQ_PREV(r)];
+
+    for (uint8_t s = connection->tx_base; s != r; s = SEQ_NEXT(s))
+        if (connection->tx_window[s]->retransmitted)
+            newest = NULL;
+
+    timer_measure(connection, newest);
+
+    for (; connection->tx_base != r;
+         connection->tx_base = SEQ_NEXT(connection->tx_base)) {
+        frame_destroy(connection->tx_window[connection->tx_base]);
+        connection->tx_window[connection->tx_base] = NULL;
     }
 
-    if (bcc == FLAG) {
-        bv_pushb(buf, ESC);
-        bv_pushb(buf, ESC_FLAG);
-    } else if (bcc == ESC) {
-        bv_pushb(buf, ESC);
-        bv_pushb(buf, ESC_ESC);
+    if (connection->tx_base == connection->tx_sequence_nr)
+        return timer_disarm(connection);
+
+    return timer_arm(connection);
+}
+
+/**
+ * @brief Stores the information of an I frame until it is read.
+ *
+ * @param connection The connection.
+ * @param frame The I frame.
+ */
+void store_information(LLConnection *connection, Frame *frame) {
+    uint8_t s = SEQ_NR(frame->command);
+
+    // Information destuffed into the memory of a pending read is always the
+    // one it waits for, so it's never left unstored
+    if (connection->rx_window[s] == NULL) {
+        connection->stats.i_frames_received++;
+        connection->stats.payload_bytes_received += frame->information->length;
+
+        if (connection->fec > 0)
+            fec_keep(connection, s, frame->information);
+
+        connection->rx_window[s] = frame->information;
+        frame->information = NULL;
     } else {
-        bv_pushb(buf, bcc);
+        connection->stats.duplicates++;
     }
+
+    connection->srej_sent[s] = false;
 }
 
-ssize_t write_frame(LLConnection *connection, Frame *frame) {
-    if (frame == NULL)
-        return -1;
+/**
+ * @brief Handles an I frame received by a connection in go back n mode.
+ *
+ * Accepts the frame if it is the one expected, otherwise asks for a
+ * retransmission from the expected frame onwards, only once per gap, or
+ * simply repeats the last acknowledgement.
+ *
+ * @param connection The connection.
+ * @param frame The I frame, possibly with #I_ERR set.
+ *
+ * @return -1 on error.
+ */
+ssize_t handle_information_gbn(LLConnection *connection, Frame *frame) {
+    uint8_t s = SEQ_NR(frame->command);
+    bool error = FRAME_TYPE(frame->command) == I_ERR;
 
-    ByteVector *buf = bv_create();
+    if (!error && s == connection->rx_sequence_nr) {
+        store_information(connection, frame);
+        connection->rx_sequence_nr = SEQ_NEXT(s);
+        connection->rej_sent = false;
 
-    bv_pushb(buf, FLAG);
-    bv_pushb(buf, frame->address);
-    bv_pushb(buf, frame->command);
-    bv_pushb(buf, make_bcc(frame));
+        return send_response(connection, RR(SEQ_NEXT(s)));
+    }
 
-    if ((frame->command & 0xF) == I(0) && frame->information != NULL)
-        write_info(buf, frame);
+    // Frames behind the expected one are duplicates caused by a lost
+    // acknowledgement, frames ahead of it mean that something was lost
+    bool duplicate =
+        SEQ_DISTANCE(s, connection->rx_sequence_nr) <= connection->window_size;
 
-    bv_pushb(buf, FLAG);
+    if ((error || !duplicate) && !connection->rej_sent) {
+        connection->rej_sent = true;
 
-    int bytes_written = write(connection->fd, buf->array, buf->length);
+        return send_response(connection, REJ(connection->rx_sequence_nr));
+    }
 
-    bv_destroy(buf);
+    if (error)
+        return 0;
 
-    return bytes_written;
+    if (duplicate)
+        connection->stats.duplicates++;
+
+    return send_response(connection, RR(connection->rx_sequence_nr));
 }
 
-void frame_destroy(Frame *this) {
-    if (this == NULL)
-        return;
+/**
+ * @brief Slides the reception window of a connection past every I frame
+ *        already received, and acknowledges them.
+ *
+ * @param connection The connection.
+ *
+ * @return -1 on error.
+ */
+ssize_t acknowledge_in_order(LLConnection *connection) {
+    while (connection->rx_window[connection->rx_sequence_nr] != NULL)
+        connection->rx_sequence_nr = SEQ_NEXT(connection->rx_sequence_nr);
 
-    if (this->information != NULL)
-        bv_destroy(this->information);
+    return send_response(connection, RR(connection->rx_sequence_nr));
+}
 
-    free(this);
+/**
+ * @brief Checks if a #SREJ sent by a connection may still be answered.
+ *
+ * Either the #SREJ or the retransmission it asked for can be lost, so the
+ * frame is asked for again once #LLConnection::rto passes without it.
+ *
+ * @param connection The connection.
+ * @param s The sequence number the #SREJ asked for.
+ *
+ * @return Whether it was sent less than a retransmission timeout ago.
+ */
+bool srej_outstanding(LLConnection *connection, uint8_t s) {
+    if (!connection->srej_sent[s])
+        return false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    const struct timespec *sent_at = &connection->srej_sent_at[s];
+    double elapsed = (now.tv_sec - sent_at->tv_sec) * 1e3 +
+                     (now.tv_nsec - sent_at->tv_nsec) / 1e6;
+
+    return elapsed < connection->rto;
 }
 
-ssize_t send_frame(LLConnection *connection, Frame *frame) {
-    ssize_t bytes_written = write_frame(connection, frame);
+/**
+ * @brief Sends a #SREJ for an I frame, and records when.
+ *
+ * @param connection The connection.
+ * @param s The sequence number of the frame.
+ *
+ * @return -1 on error.
+ */
+ssize_t send_srej(LLConnection *connection, uint8_t s) {
+    connection->srej_sent[s] = true;
+    clock_gettime(CLOCK_MONOTONIC, &connection->srej_sent_at[s]);
+
+    return send_response(connection, SREJ(s));
+}
+
+/**
+ * @brief Asks for the retransmission of every I frame missing before a given
+ *        sequence number, once per retransmission timeout.
+ *
+ * Frames that a #PARITY frame not received yet may still rebuild are left
+ * alone, see #fec_span.
+ *
+ * @param connection The connection.
+ * @param s The sequence number.
+ *
+ * @return -1 on error.
+ */
+ssize_t request_overdue(LLConnection *connection, uint8_t s) {
+    uint8_t span = fec_span(connection);
+
+    // Behind the window, every frame before it was already received
+    if (SEQ_DISTANCE(connection->rx_sequence_nr, s) >= connection->window_size)
+        return 0;
+
+    for (uint8_t m = connection->rx_sequence_nr; m != s; m = SEQ_NEXT(m)) {
+        if (connection->rx_window[m] != NULL ||
+            srej_outstanding(connection, m) || SEQ_DISTANCE(m, s) < span)
+            continue;
+
+        if (send_srej(connection, m) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Handles an I frame received by a connection in selective repeat
+ *        mode.
+ *
+ * Keeps every frame inside the reception window, even if out of order, and
+ * sends a #SREJ for each frame that is found to be missing or damaged, again
+ * only if it is still missing a retransmission timeout later, see
+ * #request_overdue. Acknowledges every frame received in
+ * order.
+ *
+ * @param connection The connection.
+ * @param frame The I frame, possibly with #I_ERR set.
+ *
+ * @return -1 on error.
+ */
+ssize_t handle_information_sr(LLConnection *connection, Frame *frame) {
+    uint8_t s = SEQ_NR(frame->command);
+    bool error = FRAME_TYPE(frame->command) == I_ERR;
+    uint8_t offset = SEQ_DISTANCE(connection->rx_sequence_nr, s);
+
+    // Behind the window, a duplicate caused by a lost acknowledgement
+    if (offset >= connection->window_size) {
+        if (error)
+            return 0;
+
+        connection->stats.duplicates++;
+        return send_response(connection, RR(connection->rx_sequence_nr));
+    }
+
+    if (error) {
+        if (connection->rx_window[s] != NULL ||
+            srej_outstanding(connection, s))
+            return 0;
+
+        // Left for the parity frame of its group to rebuild
+        if (fec_span(connection) > 0)
+            return request_overdue(connection, s);
+
+        return send_srej(connection, s);
+    }
+
+    store_information(connection, frame);
+
+    if (offset == 0)
+        return acknowledge_in_order(connection);
+
+    return request_overdue(connection, s);
+}
+
+/**
+ * @brief Checks if an I frame inside the reception window of a connection,
+ *        or just behind it, was already received.
+ *
+ * @param connection The connection.
+ * @param s The sequence number of the frame.
+ *
+ * @return Whether it was received.
+ */
+bool is_received(LLConnection *connection, uint8_t s) {
+    return SEQ_DISTANCE(connection->rx_sequence_nr, s) >=
+               connection->window_size ||
+           connection->rx_window[s] != NULL;
+}
+
+/**
+ * @brief Rebuilds the only I frame of a group that is missing, from the
+ *        group's parity and the copies of the other frames, see #fec_keep.
+ *
+ * @param connection The connection.
+ * @param parity The information of the #PARITY frame.
+ * @param first The sequence number of the first frame of the group.
+ * @param count The number of frames in the group.
+ * @param stride The distance between their sequence numbers.
+ * @param missing The sequence number of the missing frame.
+ *
+ * @return Whether it was rebuilt.
+ */
+bool rebuild_information(LLConnection *connection, const ByteVector *parity,
+                         uint8_t first, uint8_t count, uint8_t stride,
+                         uint8_t missing) {
+    ByteVector *information = pool_get_vector(&connection->pool);
+
+    bv_push(information, parity->array + FEC_HEADER_SIZE,
+            parity->length - FEC_HEADER_SIZE);
+
+    for (uint8_t i = 0; i < count; ++i) {
+        uint8_t m = (first + i * stride) % SEQ_MODULO;
+        ByteVector *copy = connection->rx_copies[m];
+
+        if (m == missing)
+            continue;
+
+        if (copy == NULL) {
+            pool_put_vector(&connection->pool, information);
+            return false;
+        }
+
+        struct iovec iov = {.iov_base = copy->array,
+                            .iov_len = copy->length};
+        fec_add(information, &iov, 1);
+    }
+
+    if (fec_recover(information) == -1) {
+        pool_put_vector(&connection->pool, information);
+        return false;
+    }
+
+    ALARM("Frame I(%d) was lost, rebuilt it from parity\n", missing);
+
+    Frame frame = {.command = I(missing), .information = information};
+    store_information(connection, &frame);
+    connection->stats.recovered++;
+
+    return true;
+}
 
-    if (bytes_written <= 0)
+/**
+ * @brief Handles a #PARITY frame received by a connection.
+ *
+ * Rebuilds the frame of its group that is missing, if only one is, see
+ * #rebuild_information, otherwise sends a #SREJ for each one missing, once
+ * per retransmission timeout. Frames of earlier groups still missing are
+ * asked for too, as their #PARITY frames were already sent, see
+ * #request_overdue.
+ *
+ * @note Ignored unless #LLConnection::fec is set, as the copies of the frames
+ *       received aren't kept otherwise.
+ *
+ * @param connection The connection.
+ * @param frame The #PARITY frame.
+ *
+ * @return -1 on error.
+ */
+ssize_t handle_parity(LLConnection *connection, Frame *frame) {
+    ByteVector *parity = frame->information;
+
+    if (connection->fec == 0 || parity->length < FEC_HEADER_SIZE)
+        return 0;
+
+    uint8_t first = SEQ_NR(frame->command);
+    uint8_t count = parity->array[0], stride = parity->array[1];
+
+    if (count == 0 || stride == 0 ||
+        (count - 1) * stride >= connection->window_size)
+        return 0;
+
+    uint8_t last = (first + (count - 1) * stride) % SEQ_MODULO;
+    uint8_t missing = 0, n_missing = 0;
+
+    for (uint8_t i = 0; i < count; ++i) {
+        uint8_t m = (first + i * stride) % SEQ_MODULO;
+
+        if (!is_received(connection, m)) {
+            missing = m;
+            n_missing++;
+        }
+    }
+
+    if (request_overdue(connection, last) == -1)
         return -1;
 
-    if (IS_COMMAND(frame->command)) {
-        frame_destroy(connection->last_command_frame);
-        connection->last_command_frame = frame;
-        connection->n_retransmissions_sent = 0;
+    if (n_missing == 1 && rebuild_information(connection, parity, first,
+                                              count, stride, missing)) {
+        if (missing == connection->rx_sequence_nr)
+            return acknowledge_in_order(connection);
 
-        if (timer_arm(connection) == -1)
+        return 0;
+    }
+
+    for (uint8_t i = 0; i < count; ++i) {
+        uint8_t m = (first + i * stride) % SEQ_MODULO;
+
+        if (is_received(connection, m) || srej_outstanding(connection, m))
+            continue;
+
+        if (send_srej(connection, m) == -1)
             return -1;
-    } else {
-        frame_destroy(frame);
     }
 
-    return bytes_written;
+    return 0;
 }
 
 /**
  * @brief Handles a received frame.
  *
  * Does something different when each type of frame is received:
- * - #SET: Sends a #UA in response;
+ * - #SET: Agrees on a frame check sequence and sends a #UA with it in
+ *   response;
  * - #DISC:
  *   - Transmitter: Sends a #UA in response;
  *   - Receiver: Sends another #DISC in response, and expects a #UA;
- * - #I: Sends an #RR in response;
- * - #UA or #RR: Disarms the retransmission timer;
- * - #REJ: Calls #timer_force;
- * - #I_ERR: Sends a #REJ in response.
+ * - #I or #I_ERR: See #handle_information_gbn and #handle_information_sr;
+ * - #PARITY: See #handle_parity;
+ * - #UA: Disarms the retransmission timer;
+ * - #RR: Acknowledges the frames before the received sequence number;
+ * - #REJ: Acknowledges the frames before the received sequence number and
+ *   retransmits the rest of them, see #timer_force;
+ * - #SREJ: Retransmits the requested frame.
  *
  * @param connection The connection the frame was received in.
  * @param frame The frame
@@ -360,15 +700,23 @@ ssize_t send_frame(LLConnection *connection, Frame *frame) {
  * @return -1 on error.
  */
 ssize_t handle_frame(LLConnection *connection, Frame *frame) {
-    LOG("Received frame (c = %s, 0x%02x)\n", get_command(frame->command),
-        frame->command);
+    TRACE_EVENT(TRACE_FRAME_RECEIVED, frame->command,
+                frame->information != NULL ? frame->information->length : 0);
 
-    switch (frame->command) {
+    switch (FRAME_TYPE(frame->command)) {
     case SET:
+        if (FCS_NR(frame->command) < connection->fcs)
+            connection->fcs = FCS_NR(frame->command);
+
         LOG("Sending UA frame to complete handshake!\n");
-        return send_frame(connection, create_frame(connection, UA));
+        return send_response(connection, WITH_FCS(UA, connection->fcs));
 
     case DISC:
+        // The DISC sent in response was lost, the UA is already awaited
+        if (connection->role == LL_RX && connection->closed)
+            return send_frame(connection, create_frame(connection, DISC));
+
+        mark_closing(connection);
         connection->closed = true;
         if (connection->role == LL_RX) {
             if (send_frame(connection, create_frame(connection, DISC)) == -1)
@@ -381,30 +729,97 @@ ssize_t handle_frame(LLConnection *connection, Frame *frame) {
             frame_destroy(f);
         } else {
             LOG("Sending UA frame to complete disconnect phase!\n");
-            return send_frame(connection, create_frame(connection, UA));
+            return send_response(connection, UA);
         }
         break;
 
+    case I_ERR:
+        connection->stats.damaged++;
+        // fall through
     case I(0):
-    case I(1): {
-        uint8_t s = frame->command >> 6;
-        return send_frame(connection, create_frame(connection, RR(1 - s)));
-    }
+        if (connection->arq == LL_SELECTIVE_REPEAT)
+            return handle_information_sr(connection, frame);
+
+        return handle_information_gbn(connection, frame);
+
+    case PARITY(0):
+        return handle_parity(connection, frame);
 
     case UA:
-    case RR(0):
-    case RR(1):
+        timer_measure(connection, connection->last_command_frame);
+
         return timer_disarm(connection);
 
+    case RR(0):
+        return acknowledge(connection, SEQ_NR(frame->command));
+
     case REJ(0):
-    case REJ(1):
+        connection->stats.rej_received++;
+
+        if (acknowledge(connection, SEQ_NR(frame->command)) == -1)
+            return -1;
+
+        if (connection->tx_base == connection->tx_sequence_nr)
+            return 0;
+
+        count_frame_error(connection);
+
+        // The frames after the one rejected got through
+        timer_progress(connection);
+
         return timer_force(connection);
 
-    case I_ERR | I(0):
-    case I_ERR | I(1): {
-        uint8_t s = frame->command >> 6;
-        return send_frame(connection, create_frame(connection, REJ(s)));
+    case SREJ(0): {
+        uint8_t r = SEQ_NR(frame->command);
+
+        connection->stats.srej_received++;
+
+        if (SEQ_DISTANCE(connection->tx_base, r) >=
+            SEQ_DISTANCE(connection->tx_base, connection->tx_sequence_nr))
+            return 0;
+
+        ALARM("Frame I(%d) was lost, retransmitting it\n", r);
+
+        count_frame_error(connection);
+
+        // The frames after the one lost got through
+        timer_progress(connection);
+
+        connection->stats.retransmissions++;
+        connection->tx_window[r]->retransmitted = true;
+        return write_frame(connection, connection->tx_window[r]);
+    }
+    }
+
+    return 0;
+}
+
+Frame *receive_frame(LLConnection *connection) {
+    Frame *frame = read_frame(connection);
+
+    if (frame == NULL)
+        return NULL;
+
+    if (handle_frame(connection, frame) < 0) {
+        frame_destroy(frame);
+        return NULL;
     }
+
+    return frame;
+}
+
+int poll_frames(LLConnection *connection) {
+    if (wait_events(connection, 0) == -1)
+        return -1;
+
+    Frame *frame;
+
+    while ((frame = parser_take(connection)) != NULL) {
+        ssize_t result = handle_frame(connection, frame);
+        frame_destroy(frame);
+
+        if (result < 0)
+            return -1;
     }
 
     return 0;
@@ -413,17 +828,12 @@ ssize_t handle_frame(LLConnection *connection, Frame *frame) {
 Frame *expect_frame(LLConnection *connection, uint8_t command) {
     Frame *frame;
     while (1) {
-        frame = read_frame(connection);
+        frame = receive_frame(connection);
 
         if (frame == NULL)
             return NULL;
 
-        if (handle_frame(connection, frame) < 0) {
-            frame_destroy(frame);
-            return NULL;
-        }
-
-        if (frame->command == command)
+        if (FRAME_TYPE(frame->command) == command)
             break;
 
         frame_destroy(frame);
@@ -433,29 +843,33 @@ Frame *expect_frame(LLConnection *connection, uint8_t command) {
 }
 
 char *get_command(uint8_t command) {
-    switch (command) {
+    static char buf[16];
+
+    switch (FRAME_TYPE(command)) {
     case SET:
         return "SET";
     case DISC:
         return "DISC";
-    case I(0):
-        return "I(0)";
-    case I(1):
-        return "I(1)";
     case UA:
         return "UA";
+    case I(0):
+        snprintf(buf, sizeof(buf), "I(%d)", SEQ_NR(command));
+        return buf;
+    case PARITY(0):
+        snprintf(buf, sizeof(buf), "P(%d)", SEQ_NR(command));
+        return buf;
     case RR(0):
-        return "RR(0)";
-    case RR(1):
-        return "RR(1)";
+        snprintf(buf, sizeof(buf), "RR(%d)", SEQ_NR(command));
+        return buf;
     case REJ(0):
-        return "REJ(0)";
-    case REJ(1):
-        return "REJ(1)";
-    case I(0) | I_ERR:
-        return "I_ERR(0)";
-    case I(1) | I_ERR:
-        return "I_ERR(1)";
+        snprintf(buf, sizeof(buf), "REJ(%d)", SEQ_NR(command));
+        return buf;
+    case SREJ(0):
+        snprintf(buf, sizeof(buf), "SREJ(%d)", SEQ_NR(command));
+        return buf;
+    case I_ERR:
+        snprintf(buf, sizeof(buf), "I_ERR(%d)", SEQ_NR(command));
+        return buf;
     }
 
     return "INVALID";
@@ -0,0 +1,387 @@
+#include "link_layer/parser.h"
+#include "link_layer/frame.h"
+#include "link_layer/pool.h"
+#include "link_layer/stuffing.h"
+
+#include <sys/param.h>
+
+/**
+ * @brief An enum representing the classes of bytes the state machine
+ *        distinguishes.
+ */
+typedef enum {
+    /**
+     * @brief Any other byte.
+     */
+    CLASS_OTHER,
+    /**
+     * @brief A #FLAG.
+     */
+    CLASS_FLAG,
+    /**
+     * @brief An #ESC.
+     */
+    CLASS_ESC,
+    /**
+     * @brief A valid address, #RX_ADDR or #TX_ADDR.
+     */
+    CLASS_ADDRESS,
+    N_CLASSES,
+} ByteClass;
+
+/**
+ * @brief An enum representing what to do on a transition.
+ */
+typedef enum {
+    /**
+     * @brief Nothing.
+     */
+    ACTION_NONE,
+    /**
+     * @brief Store the byte as the address of a new frame.
+     */
+    ACTION_ADDRESS,
+    /**
+     * @brief Store the byte as the command, back to #START if the
+     *        combination of address and command is illegal.
+     */
+    ACTION_COMMAND,
+    /**
+     * @brief Verify the byte as the header's bcc, back to #START if it
+     *        doesn't match, on to #DATA_RCV if the frame is an I or #PARITY
+     *        frame.
+     */
+    ACTION_BCC,
+    /**
+     * @brief Accept the frame.
+     */
+    ACTION_ACCEPT,
+} Action;
+
+/**
+ * @brief A struct representing a transition of the state machine.
+ */
+typedef struct {
+    /**
+     * @brief The state to go to.
+     */
+    uint8_t next;
+    /**
+     * @brief What to do.
+     */
+    uint8_t action;
+} Transition;
+
+/**
+ * @brief The class of each byte.
+ */
+static const uint8_t byte_classes[256] = {
+    [FLAG] = CLASS_FLAG,
+    [ESC] = CLASS_ESC,
+    [RX_ADDR] = CLASS_ADDRESS,
+    [TX_ADDR] = CLASS_ADDRESS,
+};
+
+/**
+ * @brief The transitions of the state machine for each state and byte class.
+ *
+ * #DATA_RCV and #ESC_RCV are not in the table, the information of I frames is
+ * destuffed in bulk by #parse_information.
+ */
+static const Transition transitions[BCC_RCV + 1][N_CLASSES] = {
+    [START] =
+        {
+            [CLASS_OTHER] = {START, ACTION_NONE},
+            [CLASS_FLAG] = {FLAG_RCV, ACTION_NONE},
+            [CLASS_ESC] = {START, ACTION_NONE},
+            [CLASS_ADDRESS] = {START, ACTION_NONE},
+        },
+    [FLAG_RCV] =
+        {
+            [CLASS_OTHER] = {START, ACTION_NONE},
+            [CLASS_FLAG] = {FLAG_RCV, ACTION_NONE},
+            [CLASS_ESC] = {START, ACTION_NONE},
+            [CLASS_ADDRESS] = {A_RCV, ACTION_ADDRESS},
+        },
+    [A_RCV] =
+        {
+            [CLASS_OTHER] = {C_RCV, ACTION_COMMAND},
+            [CLASS_FLAG] = {FLAG_RCV, ACTION_NONE},
+            [CLASS_ESC] = {C_RCV, ACTION_COMMAND},
+            [CLASS_ADDRESS] = {C_RCV, ACTION_COMMAND},
+        },
+    [C_RCV] =
+        {
+            [CLASS_OTHER] = {BCC_RCV, ACTION_BCC},
+            [CLASS_FLAG] = {FLAG_RCV, ACTION_NONE},
+            [CLASS_ESC] = {BCC_RCV, ACTION_BCC},
+            [CLASS_ADDRESS] = {BCC_RCV, ACTION_BCC},
+        },
+    [BCC_RCV] =
+        {
+            [CLASS_OTHER] = {START, ACTION_NONE},
+            [CLASS_FLAG] = {START, ACTION_ACCEPT},
+            [CLASS_ESC] = {START, ACTION_NONE},
+            [CLASS_ADDRESS] = {START, ACTION_NONE},
+        },
+};
+
+/**
+ * @return A pseudo-random number between 0 and 1.
+ */
+double rand_double() { return (double)rand() / (double)RAND_MAX; }
+
+/**
+ * @brief Queues the frame being parsed and starts a new one.
+ *
+ * @param parser The parser.
+ */
+void accept_frame(FrameParser *parser) {
+    Frame *frame = parser->frame;
+    parser->frame = NULL;
+    parser->state = START;
+
+    frame->next = NULL;
+    if (parser->last == NULL)
+        parser->first = frame;
+    else
+        parser->last->next = frame;
+    parser->last = frame;
+}
+
+/**
+ * @brief Ends or continues the information of the I or #PARITY frame being
+ *        parsed, after some of it was destuffed.
+ *
+ * Damaged I frames are accepted with #I_ERR set, damaged #PARITY frames are
+ * dropped, as they would be indistinguishable from them.
+ *
+ * @param connection The connection.
+ * @param result The result of destuffing.
+ * @param escaped Whether the last byte destuffed was an #ESC.
+ */
+void end_information(LLConnection *connection, DestuffResult result,
+                     bool escaped) {
+    FrameParser *parser = &connection->parser;
+
+    if (result == DESTUFF_MORE) {
+        parser->state = escaped ? ESC_RCV : DATA_RCV;
+        return;
+    }
+
+    ByteVector *information = parser->target != NULL
+                                  ? parser->target
+                                  : parser->frame->information;
+    size_t check_size = fcs_size(parser->fcs.mode);
+
+    if (rand_double() < connection->fer)
+        parser->fcs.value ^= 1;
+
+    if (result == DESTUFF_INVALID || information->length < check_size ||
+        !fcs_check(&parser->fcs)) {
+        if (FRAME_TYPE(parser->frame->command) == PARITY(0)) {
+            pool_put_vector(&connection->pool, information);
+            parser->frame->information = NULL;
+            parser->state = START;
+            return;
+        }
+
+        parser->frame->command |= I_ERR;
+    } else {
+        information->length -= check_size;
+
+        // Only handed to the frame once it's known to be intact
+        if (parser->target != NULL)
+            parser->frame->information = parser->target;
+    }
+
+    parser->target = NULL;
+    accept_frame(parser);
+}
+
+/**
+ * @brief Moves what was destuffed into the buffer of a pending read to a
+ *        vector of its own, because the frame doesn't fit there.
+ *
+ * @param connection The connection.
+ */
+void spill_target(LLConnection *connection) {
+    FrameParser *parser = &connection->parser;
+    ByteVector *target = parser->target;
+    ByteVector *information = pool_get_vector(&connection->pool);
+
+    size_t in_target = MIN(target->length, target->capacity);
+
+    bv_push(information, target->array, in_target);
+    bv_push(information, parser->overflow, target->length - in_target);
+
+    parser->frame->information = information;
+    parser->target = NULL;
+}
+
+/**
+ * @brief Destuffs the information of the I frame being parsed, until the end
+ *        of the frame or of the bytes.
+ *
+ * @param connection The connection.
+ * @param buf The bytes.
+ * @param len The number of bytes.
+ *
+ * @return The number of bytes consumed.
+ */
+size_t parse_information(LLConnection *connection, const uint8_t *buf,
+                         size_t len) {
+    FrameParser *parser = &connection->parser;
+    ByteVector *target = parser->target;
+    size_t consumed, produced;
+    bool escaped = parser->state == ESC_RCV;
+
+    if (target == NULL) {
+        ByteVector *information = parser->frame->information;
+
+        DestuffResult result =
+            destuff_bytes(bv_spare(information, len), buf, len, &consumed,
+                          &produced, &escaped, &parser->fcs);
+
+        bv_commit(information, produced);
+        end_information(connection, result, escaped);
+
+        return consumed;
+    }
+
+    // Destuffing never produces more bytes than it consumes, so limiting the
+    // input to the room left keeps the output in bounds
+    uint8_t *dst;
+    size_t room;
+
+    if (target->length < target->capacity) {
+        dst = target->array + target->length;
+        room = target->capacity - target->length;
+    } else {
+        size_t extra = target->length - target->capacity;
+        dst = parser->overflow + extra;
+        room = sizeof(parser->overflow) - extra;
+    }
+
+    DestuffResult result = destuff_bytes(dst, buf, MIN(len, room), &consumed,
+                                         &produced, &escaped, &parser->fcs);
+
+    target->length += produced;
+
+    if (target->length > target->capacity + fcs_size(parser->fcs.mode))
+        spill_target(connection);
+
+    end_information(connection, result, escaped);
+
+    return consumed;
+}
+
+void parse_frames(LLConnection *connection, const uint8_t *buf, size_t len) {
+    FrameParser *parser = &connection->parser;
+
+    for (size_t i = 0; i < len;) {
+        if (parser->state == DATA_RCV || parser->state == ESC_RCV) {
+            i += parse_information(connection, buf + i, len - i);
+            continue;
+        }
+
+        uint8_t byte = buf[i++];
+        Transition transition =
+            transitions[parser->state][byte_classes[byte]];
+        parser->state = transition.next;
+
+        switch (transition.action) {
+        case ACTION_ADDRESS:
+            if (parser->frame == NULL)
+                parser->frame = pool_get_frame(&connection->pool);
+
+            parser->frame->address = byte;
+            break;
+
+        case ACTION_COMMAND:
+            parser->frame->command = byte;
+
+            if (!check_command_and_address(parser->frame, connection->role))
+                parser->state = START;
+            break;
+
+        case ACTION_BCC:
+            if (byte != make_bcc(parser->frame) ||
+                rand_double() < connection->fer) {
+                parser->state = START;
+            } else if (FRAME_TYPE(parser->frame->command) == PARITY(0)) {
+                parser->state = DATA_RCV;
+                fcs_init(&parser->fcs, connection->fcs);
+                parser->frame->information =
+                    pool_get_vector(&connection->pool);
+            } else if (FRAME_TYPE(parser->frame->command) == I(0)) {
+                parser->state = DATA_RCV;
+                fcs_init(&parser->fcs, connection->fcs);
+
+                uint8_t s = SEQ_NR(parser->frame->command);
+
+                // The frame a pending read waits for goes straight to it,
+                // unless a copy of it may already be waiting to be handled
+                if (connection->rx_target.array != NULL &&
+                    s == connection->rx_read_nr &&
+                    connection->rx_window[s] == NULL && parser->first == NULL) {
+                    parser->target = &connection->rx_target;
+                    parser->target->length = 0;
+                } else {
+                    parser->frame->information =
+                        pool_get_vector(&connection->pool);
+                }
+            }
+            break;
+
+        case ACTION_ACCEPT:
+            accept_frame(parser);
+            break;
+        }
+    }
+}
+
+Frame *parser_take(LLConnection *connection) {
+    FrameParser *parser = &connection->parser;
+    Frame *frame = parser->first;
+
+    if (frame != NULL) {
+        parser->first = frame->next;
+        if (parser->first == NULL)
+            parser->last = NULL;
+    }
+
+    return frame;
+}
+
+void parser_release_target(LLConnection *connection) {
+    FrameParser *parser = &connection->parser;
+
+    if (parser->target != NULL) {
+        parser->target = NULL;
+        parser->state = START;
+    }
+
+    // Only possible if handling frames failed before reaching it
+    for (Frame *f = parser->first; f != NULL; f = f->next) {
+        if (f->information == &connection->rx_target) {
+            f->information = NULL;
+            f->command |= I_ERR;
+        }
+    }
+
+    connection->rx_target.array = NULL;
+}
+
+void parser_destroy(FrameParser *parser) {
+    frame_destroy(parser->frame);
+    parser->frame = NULL;
+
+    while (parser->first != NULL) {
+        Frame *next = parser->first->next;
+        frame_destroy(parser->first);
+        parser->first = next;
+    }
+
+    parser->last = NULL;
+}
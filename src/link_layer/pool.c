@@ -0,0 +1,66 @@
+#include "link_layer/pool.h"
+#include "link_layer/frame.h"
+
+Frame *pool_get_frame(FramePool *pool) {
+    Frame *frame = pool->frames;
+
+    if (frame != NULL) {
+        pool->frames = frame->next;
+    } else {
+        frame = malloc(sizeof(Frame));
+
+        if (frame == NULL)
+            return NULL;
+
+        pool->frame_allocations++;
+    }
+
+    frame->information = NULL;
+    frame->encoded = NULL;
+    frame->next = NULL;
+    frame->pool = pool;
+
+    return frame;
+}
+
+void pool_put_frame(FramePool *pool, Frame *frame) {
+    if (frame->information != NULL)
+        pool_put_vector(pool, frame->information);
+    if (frame->encoded != NULL)
+        pool_put_vector(pool, frame->encoded);
+
+    frame->information = NULL;
+    frame->encoded = NULL;
+    frame->next = pool->frames;
+    pool->frames = frame;
+}
+
+ByteVector *pool_get_vector(FramePool *pool) {
+    if (pool->n_vectors == 0) {
+        pool->vector_allocations++;
+        return bv_create();
+    }
+
+    ByteVector *vector = pool->vectors[--pool->n_vectors];
+    bv_clear(vector);
+
+    return vector;
+}
+
+void pool_put_vector(FramePool *pool, ByteVector *vector) {
+    if (pool->n_vectors == POOL_VECTORS)
+        bv_destroy(vector);
+    else
+        pool->vectors[pool->n_vectors++] = vector;
+}
+
+void pool_destroy(FramePool *pool) {
+    while (pool->frames != NULL) {
+        Frame *next = pool->frames->next;
+        free(pool->frames);
+        pool->frames = next;
+    }
+
+    while (pool->n_vectors > 0)
+        bv_destroy(pool->vectors[--pool->n_vectors]);
+}
@@ -0,0 +1,325 @@
+#include "link_layer/stuffing.h"
+#include "link_layer/frame.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/param.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+/**
+ * @brief How many bytes are stuffed or destuffed before updating the frame
+ *        check sequence with them, small enough that they are still cached.
+ */
+#define FCS_BLOCK 2048
+
+/**
+ * @brief A function that byte stuffs a buffer, see #stuff_bytes.
+ */
+typedef size_t (*StuffKernel)(uint8_t *, const uint8_t *, size_t);
+
+/**
+ * @brief A function that destuffs a buffer, see #destuff_bytes.
+ */
+typedef DestuffResult (*DestuffKernel)(uint8_t *, const uint8_t *, size_t,
+                                       size_t *, size_t *, bool *);
+
+/**
+ * @brief Byte stuffs a single byte.
+ *
+ * @param dst Where to write the stuffed byte, must fit 2 bytes.
+ * @param byte The byte to stuff.
+ *
+ * @return The number of bytes written to dst.
+ */
+static inline size_t stuff_byte(uint8_t *dst, uint8_t byte) {
+    if (byte == FLAG) {
+        dst[0] = ESC;
+        dst[1] = ESC_FLAG;
+        return 2;
+    } else if (byte == ESC) {
+        dst[0] = ESC;
+        dst[1] = ESC_ESC;
+        return 2;
+    }
+
+    dst[0] = byte;
+    return 1;
+}
+
+/**
+ * @brief Destuffs a single byte.
+ *
+ * @param dst Where to write the destuffed bytes.
+ * @param produced The index in dst to write to, incremented if a byte is
+ *                 written.
+ * @param byte The byte to destuff.
+ * @param escaped Whether the previous byte was an #ESC, updated with whether
+ *                this one is.
+ *
+ * @return #DESTUFF_MORE if destuffing should continue.
+ */
+static inline DestuffResult destuff_byte(uint8_t *dst, size_t *produced,
+                                         uint8_t byte, bool *escaped) {
+    if (*escaped) {
+        *escaped = false;
+
+        if (byte == ESC_FLAG)
+            byte = FLAG;
+        else if (byte == ESC_ESC)
+            byte = ESC;
+        else
+            return DESTUFF_INVALID;
+    } else if (byte == ESC) {
+        *escaped = true;
+        return DESTUFF_MORE;
+    } else if (byte == FLAG) {
+        return DESTUFF_FLAG;
+    }
+
+    dst[(*produced)++] = byte;
+
+    return DESTUFF_MORE;
+}
+
+size_t stuff_bytes_scalar(uint8_t *dst, const uint8_t *src, size_t len) {
+    size_t o = 0;
+
+    for (size_t i = 0; i < len; ++i)
+        o += stuff_byte(dst + o, src[i]);
+
+    return o;
+}
+
+DestuffResult destuff_bytes_scalar(uint8_t *dst, const uint8_t *src,
+                                   size_t len, size_t *consumed,
+                                   size_t *produced, bool *escaped) {
+    DestuffResult result = DESTUFF_MORE;
+    size_t i = 0;
+    *produced = 0;
+
+    while (i < len && result == DESTUFF_MORE)
+        result = destuff_byte(dst, produced, src[i++], escaped);
+
+    *consumed = i;
+    return result;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2"))) size_t
+stuff_bytes_sse2(uint8_t *dst, const uint8_t *src, size_t len) {
+    const __m128i flag = _mm_set1_epi8((char)FLAG);
+    const __m128i esc = _mm_set1_epi8((char)ESC);
+    size_t i = 0, o = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, esc)));
+
+        if (mask == 0) {
+            _mm_storeu_si128((__m128i *)(dst + o), v);
+            o += 16;
+            continue;
+        }
+
+        // Copy the clean runs between special bytes
+        for (unsigned start = 0; start < 16;) {
+            unsigned end = mask ? (unsigned)__builtin_ctz(mask) : 16;
+            memcpy(dst + o, src + i + start, end - start);
+            o += end - start;
+
+            if (end < 16)
+                o += stuff_byte(dst + o, src[i + end]);
+
+            mask &= mask - 1;
+            start = end + 1;
+        }
+    }
+
+    return o + stuff_bytes_scalar(dst + o, src + i, len - i);
+}
+
+__attribute__((target("sse2"))) DestuffResult
+destuff_bytes_sse2(uint8_t *dst, const uint8_t *src, size_t len,
+                   size_t *consumed, size_t *produced, bool *escaped) {
+    const __m128i flag = _mm_set1_epi8((char)FLAG);
+    const __m128i esc = _mm_set1_epi8((char)ESC);
+    DestuffResult result = DESTUFF_MORE;
+    size_t i = 0;
+    *produced = 0;
+
+    while (i < len && result == DESTUFF_MORE) {
+        if (!*escaped && i + 16 <= len) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            unsigned mask = _mm_movemask_epi8(_mm_or_si128(
+                _mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, esc)));
+
+            _mm_storeu_si128((__m128i *)(dst + *produced), v);
+
+            if (mask == 0) {
+                i += 16;
+                *produced += 16;
+                continue;
+            }
+
+            unsigned run = __builtin_ctz(mask);
+            i += run;
+            *produced += run;
+        }
+
+        result = destuff_byte(dst, produced, src[i++], escaped);
+    }
+
+    *consumed = i;
+    return result;
+}
+
+__attribute__((target("avx2"))) size_t
+stuff_bytes_avx2(uint8_t *dst, const uint8_t *src, size_t len) {
+    const __m256i flag = _mm256_set1_epi8((char)FLAG);
+    const __m256i esc = _mm256_set1_epi8((char)ESC);
+    size_t i = 0, o = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(v, flag), _mm256_cmpeq_epi8(v, esc)));
+
+        if (mask == 0) {
+            _mm256_storeu_si256((__m256i *)(dst + o), v);
+            o += 32;
+            continue;
+        }
+
+        // Copy the clean runs between special bytes
+        for (unsigned start = 0; start < 32;) {
+            unsigned end = mask ? (unsigned)__builtin_ctz(mask) : 32;
+            memcpy(dst + o, src + i + start, end - start);
+            o += end - start;
+
+            if (end < 32)
+                o += stuff_byte(dst + o, src[i + end]);
+
+            mask &= mask - 1;
+            start = end + 1;
+        }
+    }
+
+    return o + stuff_bytes_sse2(dst + o, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) DestuffResult
+destuff_bytes_avx2(uint8_t *dst, const uint8_t *src, size_t len,
+                   size_t *consumed, size_t *produced, bool *escaped) {
+    const __m256i flag = _mm256_set1_epi8((char)FLAG);
+    const __m256i esc = _mm256_set1_epi8((char)ESC);
+    DestuffResult result = DESTUFF_MORE;
+    size_t i = 0;
+    *produced = 0;
+
+    while (i < len && result == DESTUFF_MORE) {
+        if (!*escaped && i + 32 <= len) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+            unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+                _mm256_cmpeq_epi8(v, flag), _mm256_cmpeq_epi8(v, esc)));
+
+            _mm256_storeu_si256((__m256i *)(dst + *produced), v);
+
+            if (mask == 0) {
+                i += 32;
+                *produced += 32;
+                continue;
+            }
+
+            unsigned run = __builtin_ctz(mask);
+            i += run;
+            *produced += run;
+        }
+
+        result = destuff_byte(dst, produced, src[i++], escaped);
+    }
+
+    *consumed = i;
+    return result;
+}
+
+#endif
+
+/**
+ * @brief The fastest kernel the CPU supports to byte stuff buffers.
+ */
+static StuffKernel stuff_kernel = stuff_bytes_scalar;
+
+/**
+ * @brief The fastest kernel the CPU supports to destuff buffers.
+ */
+static DestuffKernel destuff_kernel = destuff_bytes_scalar;
+
+/**
+ * @brief Makes the kernels be picked only once, even if connections are used
+ *        from several threads.
+ */
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Picks the fastest kernels the CPU supports.
+ */
+void select_kernels(void) {
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        stuff_kernel = stuff_bytes_avx2;
+        destuff_kernel = destuff_bytes_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        stuff_kernel = stuff_bytes_sse2;
+        destuff_kernel = destuff_bytes_sse2;
+    }
+#endif
+}
+
+size_t stuff_bytes(uint8_t *dst, const uint8_t *src, size_t len, Fcs *fcs) {
+    pthread_once(&kernels_once, select_kernels);
+
+    size_t o = 0;
+
+    for (size_t i = 0; i < len; i += FCS_BLOCK) {
+        size_t n = MIN(FCS_BLOCK, len - i);
+
+        o += stuff_kernel(dst + o, src + i, n);
+
+        if (fcs != NULL)
+            fcs_update(fcs, src + i, n);
+    }
+
+    return o;
+}
+
+DestuffResult destuff_bytes(uint8_t *dst, const uint8_t *src, size_t len,
+                            size_t *consumed, size_t *produced, bool *escaped,
+                            Fcs *fcs) {
+    pthread_once(&kernels_once, select_kernels);
+
+    DestuffResult result = DESTUFF_MORE;
+    *consumed = 0;
+    *produced = 0;
+
+    while (*consumed < len && result == DESTUFF_MORE) {
+        size_t c, p;
+
+        result =
+            destuff_kernel(dst + *produced, src + *consumed,
+                           MIN(FCS_BLOCK, len - *consumed), &c, &p, escaped);
+
+        if (fcs != NULL)
+            fcs_update(fcs, dst + *produced, p);
+
+        *consumed += c;
+        *produced += p;
+    }
+
+    return result;
+}
@@ -1,78 +1,224 @@
 #include "link_layer/timer.h"
 #include "log.h"
-#include <sys/signal.h>
-#include <sys/time.h>
+#include "trace.h"
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 /**
- * @brief Retransmits the last command frame that a connection sent.
+ * @brief Computes the retransmission timeout of a connection from its round
+ *        trip time estimate, without any backoff.
  *
- * Gets called when a retransmission timer fires.
+ * @param connection The connection.
  *
- * @param val The connection this was called in.
+ * @return The timeout, in milliseconds.
  */
-void timer_handler(union sigval val) {
-    LLConnection *connection = val.sival_ptr;
+unsigned int base_rto(const LLConnection *connection) {
+    double rto = connection->srtt == 0
+                     ? TIMEOUT * 1000
+                     : connection->srtt + 4 * connection->rttvar;
 
-    if (connection->n_retransmissions_sent == N_TRIES) {
-        timer_disarm(connection);
-        kill(getpid(), SIGCONT);
-        return;
-    }
+    return MIN(MAX(rto, RTO_MIN), RTO_MAX);
+}
+
+/**
+ * @brief Retransmits the I frames awaiting acknowledgement or, if there are
+ *        none or they were given up on, the last command frame that a
+ *        connection sent.
+ *
+ * In go back n mode every unacknowledged frame is retransmitted, in selective
+ * repeat mode only the oldest one is.
+ *
+ * @param connection The connection.
+ *
+ * @return false if the maximum number of retransmissions was reached.
+ */
+bool retransmit(LLConnection *connection) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Retransmissions follow the round trip time, but the other side is only
+    // given up on after as long as with timeouts of TIMEOUT seconds
+    const struct timespec *since = &connection->tries_since;
+    int64_t waited_ms = (now.tv_sec - since->tv_sec) * 1000 +
+                        (now.tv_nsec - since->tv_nsec) / 1000000;
+
+    if (connection->n_retransmissions_sent >= N_TRIES &&
+        waited_ms >= (N_TRIES + 1) * TIMEOUT * 1000)
+        return false;
+
+    // After giving up on the I frames, only the DISC is still retried
+    bool frames_pending = connection->tx_base != connection->tx_sequence_nr &&
+                          !connection->failed;
+
+    if (frames_pending && connection->arq == LL_SELECTIVE_REPEAT) {
+        ALARM("Acknowledgement not received, retrying I(%d)\n",
+              connection->tx_base);
+
+        Frame *frame = connection->tx_window[connection->tx_base];
+        frame->retransmitted = true;
+        write_frame(connection, frame);
+        connection->stats.retransmissions++;
+    } else if (frames_pending) {
+        ALARM("Acknowledgement not received, going back to I(%d)\n",
+              connection->tx_base);
 
-    ALARM("Acknowledgement not received, retrying (c = %02x)\n",
-          connection->last_command_frame->command);
+        // Every frame in the window was encoded when first sent
+        struct iovec iov[SEQ_MODULO];
+        int n = 0;
+
+        for (uint8_t s = connection->tx_base; s != connection->tx_sequence_nr;
+             s = SEQ_NEXT(s)) {
+            Frame *frame = connection->tx_window[s];
+            frame->retransmitted = true;
+            TRACE_EVENT(TRACE_FRAME_RESENT, frame->command,
+                        frame->encoded->length);
+            iov[n++] = (struct iovec){.iov_base = frame->encoded->array,
+                                      .iov_len = frame->encoded->length};
+        }
+
+        ssize_t bytes_written = writev(connection->fd, iov, n);
+
+        if (bytes_written > 0)
+            connection->stats.wire_bytes_sent += bytes_written;
+        connection->stats.retransmissions += n;
+    } else {
+        ALARM("Acknowledgement not received, retrying (c = %02x)\n",
+              connection->last_command_frame->command);
+
+        connection->last_command_frame->retransmitted = true;
+        write_frame(connection, connection->last_command_frame);
+        connection->stats.retransmissions++;
+    }
 
-    write_frame(connection, connection->last_command_frame);
     connection->n_retransmissions_sent++;
+
+    return true;
 }
 
 /**
- * @brief Handles a signal.
+ * @brief Stops retransmitting the frames of a connection, once the other side
+ *        stopped answering them.
+ *
+ * @param connection The connection.
  *
- * Only needed so blocking syscalls can be canceled.
+ * @return -1, with errno set to ETIMEDOUT.
  */
-void signal_handler() {
-    ERROR("Max retries achieved, endpoints are probably disconnected, closing "
-          "connection!\n");
+int give_up(LLConnection *connection) {
+    ERROR("Max retries achieved, endpoints are probably disconnected, "
+          "closing connection!\n");
+
+    connection->failed = true;
+    timer_disarm(connection);
+
+    errno = ETIMEDOUT;
+    return -1;
 }
 
-int timer_setup(LLConnection *connection) {
-    struct sigevent event = {.sigev_notify = SIGEV_THREAD,
-                             .sigev_value.sival_ptr = connection,
-                             .sigev_notify_function = timer_handler};
+int timer_expired(LLConnection *connection) {
+    connection->stats.timeouts++;
+    TRACE_EVENT(TRACE_TIMER_EXPIRED, 0, connection->n_retransmissions_sent);
+
+    if (connection->tx_base != connection->tx_sequence_nr)
+        count_frame_error(connection);
+
+    if (!retransmit(connection))
+        return give_up(connection);
+
+    // Backing off further than the fixed timeout only stalls the transfer
+    // if errors are frequent, not just a longer round trip
+    unsigned int base = base_rto(connection);
+    unsigned int limit = MAX(base, MIN(RTO_BACKOFF * base, TIMEOUT * 1000));
 
-    struct sigaction sa;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_handler = signal_handler;
-    sa.sa_flags = 0;
-    sigaction(SIGCONT, &sa, NULL);
+    connection->rto = MIN(2 * connection->rto, limit);
 
-    return timer_create(CLOCK_MONOTONIC, &event, &connection->timer);
+    return timer_arm(connection);
+}
+
+int timer_setup(LLConnection *connection) {
+    connection->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+
+    return connection->timer == -1 ? -1 : 0;
 }
 
 int timer_destroy(LLConnection *connection) {
-    return timer_delete(connection->timer);
+    if (connection->timer == -1)
+        return 0;
+
+    return close(connection->timer);
 }
 
 int timer_arm(LLConnection *connection) {
-    struct itimerspec ts = {.it_value = {.tv_sec = TIMEOUT, .tv_nsec = 0},
-                            .it_interval = {.tv_sec = TIMEOUT, .tv_nsec = 0}};
+    struct timespec rto = {.tv_sec = connection->rto / 1000,
+                           .tv_nsec = connection->rto % 1000 * 1000000};
+    struct itimerspec ts = {.it_value = rto};
+
+    TRACE_EVENT(TRACE_TIMER_ARMED, 0, connection->rto);
 
-    return timer_settime(connection->timer, 0, &ts, 0);
+    return timerfd_settime(connection->timer, 0, &ts, NULL);
 }
 
 int timer_disarm(LLConnection *connection) {
     struct itimerspec ts = {.it_value = {.tv_sec = 0, .tv_nsec = 0},
                             .it_interval = {.tv_sec = 0, .tv_nsec = 0}};
 
-    return timer_settime(connection->timer, 0, &ts, 0);
+    TRACE_EVENT(TRACE_TIMER_DISARMED, 0, 0);
+
+    return timerfd_settime(connection->timer, 0, &ts, NULL);
+}
+
+bool timer_armed(LLConnection *connection) {
+    struct itimerspec ts;
+
+    if (timerfd_gettime(connection->timer, &ts) == -1)
+        return false;
+
+    return ts.it_value.tv_sec != 0 || ts.it_value.tv_nsec != 0;
 }
 
 int timer_force(LLConnection *connection) {
-    union sigval val;
-    val.sival_ptr = connection;
-    timer_handler(val);
+    if (!retransmit(connection))
+        return give_up(connection);
 
     return timer_arm(connection);
 }
+
+void timer_reset_tries(LLConnection *connection) {
+    connection->n_retransmissions_sent = 0;
+    clock_gettime(CLOCK_MONOTONIC, &connection->tries_since);
+}
+
+void timer_progress(LLConnection *connection) {
+    connection->rto = base_rto(connection);
+    timer_reset_tries(connection);
+}
+
+void timer_measure(LLConnection *connection, Frame *frame) {
+    // Karn's rule: the acknowledgement may be for any of the transmissions,
+    // but still shows that frames get through
+    if (frame == NULL || frame->retransmitted) {
+        timer_progress(connection);
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double rtt = (now.tv_sec - frame->sent_at.tv_sec) * 1e3 +
+                 (now.tv_nsec - frame->sent_at.tv_nsec) / 1e6;
+
+    if (connection->srtt == 0) {
+        connection->srtt = rtt;
+        connection->rttvar = rtt / 2;
+    } else {
+        double deviation = rtt > connection->srtt ? rtt - connection->srtt
+                                                  : connection->srtt - rtt;
+
+        connection->rttvar = 0.75 * connection->rttvar + 0.25 * deviation;
+        connection->srtt = 0.875 * connection->srtt + 0.125 * rtt;
+    }
+
+    timer_progress(connection);
+}
@@ -0,0 +1,24 @@
+#include "options.h"
+#include "log.h"
+
+#include <stdlib.h>
+
+#undef LOG_NAME
+#define LOG_NAME "OPTIONS"
+
+double option(const char *name, double default_value) {
+    const char *value = getenv(name);
+
+    if (value == NULL || *value == '\0')
+        return default_value;
+
+    char *end;
+    double result = strtod(value, &end);
+
+    if (*end != '\0') {
+        ALARM("Ignoring %s=%s, which isn't a number\n", name, value);
+        return default_value;
+    }
+
+    return result;
+}
@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include "log.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#undef LOG_NAME
+#define LOG_NAME "TRACE"
+
+__thread TraceRing *trace_ring = NULL;
+
+/**
+ * @brief Every ring created, newest first.
+ */
+static TraceRing *rings = NULL;
+
+/**
+ * @brief Makes the rings be dumped on exit only once.
+ */
+static pthread_once_t dump_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief The names of the events, indexed by their value.
+ */
+static const char *event_names[TRACE_EVENTS] = {
+    [TRACE_PHASE] = "PHASE",
+    [TRACE_FRAME_SENT] = "FRAME_SENT",
+    [TRACE_FRAME_RESENT] = "FRAME_RESENT",
+    [TRACE_FRAME_RECEIVED] = "FRAME_RECEIVED",
+    [TRACE_BYTES_READ] = "BYTES_READ",
+    [TRACE_TIMER_ARMED] = "TIMER_ARMED",
+    [TRACE_TIMER_DISARMED] = "TIMER_DISARMED",
+    [TRACE_TIMER_EXPIRED] = "TIMER_EXPIRED",
+    [TRACE_LLWRITE] = "LLWRITE",
+    [TRACE_LLREAD] = "LLREAD",
+    [TRACE_PACKET_RECEIVED] = "PACKET_RECEIVED",
+    [TRACE_FRAGMENT_COMPRESSED] = "FRAGMENT_COMPRESSED",
+    [TRACE_FILE_WRITTEN] = "FILE_WRITTEN",
+};
+
+/**
+ * @brief Dumps the rings to the file named by the TRACE_FILE environment
+ *        variable, if set.
+ */
+void dump_at_exit(void) {
+    const char *path = getenv("TRACE_FILE");
+
+    if (path != NULL && *path != '\0' && trace_dump(path) == -1)
+        ERROR("Dumping trace to %s: %s\n", path, strerror(errno));
+}
+
+/**
+ * @brief Makes the rings be dumped on exit.
+ */
+void register_dump(void) { atexit(dump_at_exit); }
+
+TraceRing *trace_ring_create(void) {
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+
+    if (ring == NULL)
+        return NULL;
+
+    ring->thread = gettid();
+
+    // Pushed without locking, as threads may start tracing at the same time
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    pthread_once(&dump_once, register_dump);
+
+    trace_ring = ring;
+    return ring;
+}
+
+int trace_dump(const char *path) {
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL)
+        return -1;
+
+    uint32_t header[] = {TRACE_VERSION, sizeof(TraceRecord)};
+
+    fwrite(TRACE_MAGIC, 1, sizeof(TRACE_MAGIC), file);
+    fwrite(header, sizeof(header), 1, file);
+
+    for (TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+         ring != NULL; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+        uint32_t thread_header[] = {ring->thread, head - first};
+
+        fwrite(thread_header, sizeof(thread_header), 1, file);
+
+        // The oldest records are at the end of the array once it wrapped
+        for (uint64_t i = first; i < head;) {
+            size_t index = i & (TRACE_RECORDS - 1);
+            size_t n = TRACE_RECORDS - index;
+
+            if (n > head - i)
+                n = head - i;
+
+            fwrite(&ring->records[index], sizeof(TraceRecord), n, file);
+            i += n;
+        }
+    }
+
+    bool failed = ferror(file);
+
+    if (fclose(file) == EOF || failed)
+        return -1;
+
+    return 0;
+}
+
+const char *trace_event_name(uint16_t event) {
+    return event < TRACE_EVENTS ? event_names[event] : NULL;
+}
@@ -0,0 +1,187 @@
+// Offline decoder of the trace files dumped by trace_dump
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "link_layer/frame.h"
+#include "trace.h"
+
+/**
+ * @brief A struct representing a record read from a trace file.
+ */
+typedef struct {
+    /**
+     * @brief The id of the thread that traced it.
+     */
+    uint32_t thread;
+    /**
+     * @brief The record.
+     */
+    TraceRecord record;
+} Entry;
+
+/**
+ * @brief The names of the phases of a connection.
+ */
+static const char *phase_names[] = {
+    [TRACE_OPENING] = "OPENING",
+    [TRACE_ESTABLISHED] = "ESTABLISHED",
+    [TRACE_CLOSING] = "CLOSING",
+    [TRACE_CLOSED] = "CLOSED",
+};
+
+/**
+ * @brief Orders entries by time, then by thread.
+ */
+int compare_entries(const void *a, const void *b) {
+    const Entry *x = a, *y = b;
+
+    if (x->record.time != y->record.time)
+        return x->record.time < y->record.time ? -1 : 1;
+
+    return x->thread < y->thread ? -1 : x->thread > y->thread;
+}
+
+/**
+ * @brief Writes the name of a frame command into a buffer.
+ */
+void command_name(char *buf, size_t size, uint8_t command) {
+    uint8_t s = SEQ_NR(command);
+
+    switch (FRAME_TYPE(command)) {
+    case SET:
+        snprintf(buf, size, "SET");
+        break;
+    case DISC:
+        snprintf(buf, size, "DISC");
+        break;
+    case UA:
+        snprintf(buf, size, "UA");
+        break;
+    case I(0):
+        snprintf(buf, size, "I(%d)", s);
+        break;
+    case I_ERR:
+        snprintf(buf, size, "I_ERR(%d)", s);
+        break;
+    case PARITY(0):
+        snprintf(buf, size, "P(%d)", s);
+        break;
+    case RR(0):
+        snprintf(buf, size, "RR(%d)", s);
+        break;
+    case REJ(0):
+        snprintf(buf, size, "REJ(%d)", s);
+        break;
+    case SREJ(0):
+        snprintf(buf, size, "SREJ(%d)", s);
+        break;
+    default:
+        snprintf(buf, size, "0x%02x", command);
+    }
+}
+
+/**
+ * @brief Prints an entry, with its time relative to the first one.
+ */
+void print_entry(const Entry *entry, uint64_t start) {
+    const TraceRecord *r = &entry->record;
+    const char *name = trace_event_name(r->event);
+    char arg[32];
+
+    switch (r->event) {
+    case TRACE_PHASE:
+        snprintf(arg, sizeof(arg), "%s",
+                 r->arg < sizeof(phase_names) / sizeof(phase_names[0])
+                     ? phase_names[r->arg]
+                     : "?");
+        break;
+    case TRACE_FRAME_SENT:
+    case TRACE_FRAME_RESENT:
+    case TRACE_FRAME_RECEIVED:
+        command_name(arg, sizeof(arg), r->arg);
+        break;
+    case TRACE_PACKET_RECEIVED:
+        snprintf(arg, sizeof(arg), "type %u", r->arg);
+        break;
+    default:
+        arg[0] = '\0';
+    }
+
+    printf("%14.6f\t%u\t%s\t%s\t%u\n", (r->time - start) / 1e6,
+           entry->thread, name != NULL ? name : "?", arg, r->value);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s TRACE_FILE\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32_t header[2];
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(header), 1, file) != 1) {
+        fprintf(stderr, "%s isn't a trace file\n", argv[1]);
+        return 1;
+    }
+
+    if (header[0] != TRACE_VERSION || header[1] != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s has version %u, records of %u bytes\n", argv[1],
+                header[0], header[1]);
+        return 1;
+    }
+
+    Entry *entries = NULL;
+    size_t n_entries = 0;
+    uint32_t thread_header[2];
+
+    while (fread(thread_header, sizeof(thread_header), 1, file) == 1) {
+        uint32_t n = thread_header[1];
+        Entry *grown = realloc(entries, (n_entries + n) * sizeof(Entry));
+
+        if (grown == NULL) {
+            perror("realloc");
+            return 1;
+        }
+
+        entries = grown;
+
+        for (uint32_t i = 0; i < n; ++i) {
+            Entry *entry = &entries[n_entries];
+
+            if (fread(&entry->record, sizeof(TraceRecord), 1, file) != 1) {
+                fprintf(stderr, "%s is truncated\n", argv[1]);
+                break;
+            }
+
+            entry->thread = thread_header[0];
+            n_entries++;
+        }
+    }
+
+    fclose(file);
+
+    // Each thread's records are in order, but threads are interleaved by time
+    qsort(entries, n_entries, sizeof(Entry), compare_entries);
+
+    printf("ms\tthread\tevent\targ\tvalue\n");
+
+    for (size_t i = 0; i < n_entries; ++i)
+        print_entry(&entries[i], entries[0].record.time);
+
+    free(entries);
+
+    return 0;
+}